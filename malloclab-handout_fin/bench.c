@@ -0,0 +1,168 @@
+/*
+ * bench.c - Estimate the time (in seconds) used by a function f, with
+ *     a confidence interval
+ *
+ * f is run a few times untimed to warm up the caches, the heap and the
+ * branch predictors, then timed reps times with CLOCK_MONOTONIC. Runs
+ * disturbed by interrupts or migrations are rejected with Tukey's
+ * fences, and the mean of the kept runs is reported with the 95%
+ * confidence interval of Student's t distribution. Unlike the K-best
+ * schemes of fcyc.c and ftimer.c, the interval says how far two
+ * measurements may differ by chance, so a regression check can
+ * compare intervals instead of guessing a tolerance.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sched.h>
+
+#include "bench.h"
+
+/* Default values */
+#define WARMUP 2             /* untimed runs */
+#define REPS 15              /* timed runs */
+#define MAXREPS 1000         /* cap of set_bench_reps */
+#define OUTLIERS 1           /* reject outliers */
+
+static int warmup = WARMUP;
+static int reps = REPS;
+static int outliers = OUTLIERS;
+
+static bench_stats_t last;
+
+/* Two-sided 95% critical values of Student's t, by degrees of freedom */
+static const double t95[31] = {
+    0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262,
+    2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093,
+    2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045,
+    2.042
+};
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * quantile - the q quantile of the n sorted values v[] (linear interpolation)
+ */
+static double quantile(double *v, int n, double q)
+{
+    double pos = q * (n - 1);
+    int i = (int)pos;
+
+    if (i >= n - 1)
+	return v[n - 1];
+    return v[i] + (pos - i) * (v[i + 1] - v[i]);
+}
+
+/* 
+ * bench - Time f(argp) and return the mean secs of the kept runs 
+ */
+double bench(bench_funct f, void *argp, bench_stats_t *stats)
+{
+    double v[MAXREPS], lo, hi, iqr, sum, sq, var, t0;
+    int i, n;
+
+    for (i = 0; i < warmup; i++)
+	f(argp);
+    for (i = 0; i < reps; i++) {
+	t0 = now();
+	f(argp);
+	v[i] = now() - t0;
+    }
+    qsort(v, reps, sizeof(double), cmp_double);
+
+    memset(&last, 0, sizeof(last));
+    lo = v[0];
+    hi = v[reps - 1];
+    if (outliers && reps >= 4) {
+	iqr = quantile(v, reps, 0.75) - quantile(v, reps, 0.25);
+	lo = quantile(v, reps, 0.25) - 1.5 * iqr;
+	hi = quantile(v, reps, 0.75) + 1.5 * iqr;
+    }
+
+    /* The kept runs are a contiguous range of the sorted ones */
+    for (i = 0; v[i] < lo; i++)
+	;
+    for (n = reps; v[n - 1] > hi; n--)
+	;
+    last.outliers = reps - (n - i);
+    last.samples = n - i;
+    last.min = v[i];
+    last.max = v[n - 1];
+    last.median = quantile(v + i, n - i, 0.5);
+
+    for (sum = 0, sq = 0; i < n; i++) {
+	sum += v[i];
+	sq += v[i] * v[i];
+    }
+    n = last.samples;
+    last.mean = sum / n;
+    if (n > 1) {
+	var = (sq - sum * sum / n) / (n - 1);
+	last.stddev = (var > 0) ? sqrt(var) : 0;
+	last.ci95 = ((n - 1 <= 30) ? t95[n - 1] : 1.96) * last.stddev / sqrt(n);
+    }
+
+    if (stats)
+	*stats = last;
+    return last.mean;
+}
+
+bench_stats_t *bench_last(void)
+{
+    return &last;
+}
+
+/* 
+ * set_bench_warmup - Untimed runs before the timed ones 
+ */
+void set_bench_warmup(int n)
+{
+    warmup = (n < 0) ? 0 : n;
+}
+
+/* 
+ * set_bench_reps - Number of timed runs (2 to MAXREPS)
+ */
+void set_bench_reps(int n)
+{
+    reps = (n < 2) ? 2 : (n > MAXREPS) ? MAXREPS : n;
+}
+
+/* 
+ * set_bench_cpu - Pin the calling thread to cpu (-1: leave it alone)
+ */
+int set_bench_cpu(int cpu)
+{
+    cpu_set_t set;
+
+    if (cpu < 0)
+	return 0;
+    if (cpu >= CPU_SETSIZE)
+	return -1;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set);
+}
+
+/* 
+ * set_bench_outliers - When set, reject runs outside the Tukey fences
+ */
+void set_bench_outliers(int reject)
+{
+    outliers = reject;
+}
@@ -0,0 +1,56 @@
+/*
+ * bench.h - prototypes for the statistical benchmark runner in bench.c,
+ *     which estimates the running time in seconds of a test function f
+ *     with a confidence interval
+ */
+
+/* The test function takes a generic pointer as input */
+typedef void (*bench_funct)(void *);
+
+/* The statistics of one measurement */
+typedef struct {
+    int samples;     /* timed runs kept */
+    int outliers;    /* timed runs rejected as outliers */
+    double mean;     /* mean secs of the kept runs */
+    double median;
+    double stddev;
+    double ci95;     /* half width of the 95% confidence interval of the mean */
+    double min, max;
+} bench_stats_t;
+
+/* Estimate the running time of f(argp) in seconds (the mean of the kept
+   runs). When stats is not NULL, the full statistics go there. */
+double bench(bench_funct f, void *argp, bench_stats_t *stats);
+
+/* The statistics of the latest call to bench() */
+bench_stats_t *bench_last(void);
+
+/*********************************************************
+ * Set the various parameters used by the benchmark runner
+ *********************************************************/
+
+/* 
+ * set_bench_warmup - Untimed runs before the timed ones 
+ *     Default = 2
+ */
+void set_bench_warmup(int n);
+
+/* 
+ * set_bench_reps - Number of timed runs (at least 2)
+ *     Default = 15
+ */
+void set_bench_reps(int n);
+
+/* 
+ * set_bench_cpu - Pin the calling thread to this CPU (-1: don't pin). 
+ *     Returns -1 if the CPU can't be used.
+ *     Default = -1
+ */
+int set_bench_cpu(int cpu);
+
+/* 
+ * set_bench_outliers - When set, runs outside the Tukey fences 
+ *     (1.5 interquartile ranges beyond the quartiles) are rejected 
+ *     Default = 1
+ */
+void set_bench_outliers(int reject);
@@ -0,0 +1,37 @@
+/*
+ * bintrace.h - Binary trace format for mdriver
+ *
+ * A binary trace holds the same requests as a .rep text trace, laid
+ * out exactly as mdriver keeps them in memory: a bintrace_hdr_t and
+ * then num_ops traceop_t records, in host byte order. mdriver mmaps
+ * such a file and replays the records in place, without parsing.
+ * rep2bin converts a .rep trace, "gentrace -b" writes one directly.
+ */
+#ifndef __BINTRACE_H_
+#define __BINTRACE_H_
+
+#include <stdint.h>
+
+#define BINTRACE_MAGIC   0x5045524d  /* "MREP" */
+#define BINTRACE_VERSION 1
+
+/* Request types */
+enum {ALLOC, FREE, REALLOC};
+
+typedef struct {
+    uint32_t magic;          /* BINTRACE_MAGIC */
+    uint32_t version;        /* BINTRACE_VERSION */
+    int32_t sugg_heapsize;   /* the four .rep header fields */
+    int32_t num_ids;
+    int32_t num_ops;
+    int32_t weight;
+} bintrace_hdr_t;
+
+/* Characterizes a single trace operation (allocator request) */
+typedef struct {
+    int32_t type;            /* ALLOC, FREE or REALLOC */
+    int32_t index;           /* block id, for free() to use later */
+    int32_t size;            /* byte size of alloc/realloc request */
+} traceop_t;
+
+#endif /* __BINTRACE_H_ */
@@ -53,20 +53,29 @@
 #define UTIL_WEIGHT .60
 
 /* 
- * Alignment requirement in bytes (either 4 or 8) 
+ * Alignment requirement in bytes (either 8 or 16). mm.c is built
+ * with the same value, so override it for both with -DALIGNMENT=16
+ * in MMFLAGS.
  */
+#ifndef ALIGNMENT
 #define ALIGNMENT 8  
+#endif
 
 /* 
- * Maximum heap size in bytes 
+ * Maximum heap size in bytes. memlib.c only reserves the address
+ * space, so the native 64-bit build (mdriver64) can model heaps well
+ * beyond 4 GB, e.g. with -DMAX_HEAP=8589934592 in MMFLAGS.
  */
-#define MAX_HEAP (20*(1<<20))  /* 20 MB */
+#ifndef MAX_HEAP
+#define MAX_HEAP ((size_t)20*(1<<20))  /* 20 MB */
+#endif
 
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
  *****************************************************************************/
 #define USE_FCYC   0   /* cycle counter w/K-best scheme (x86 & Alpha only) */
 #define USE_ITIMER 0   /* interval timer (any Unix box) */
-#define USE_GETTOD 1   /* gettimeofday (any Unix box) */
+#define USE_GETTOD 0   /* gettimeofday (any Unix box) */
+#define USE_BENCH  1   /* warmup, outlier rejection, 95% CI (see bench.c) */
 
 #endif /* __CONFIG_H */
@@ -6,6 +6,7 @@
 #include "fcyc.h"
 #include "clock.h"
 #include "ftimer.h"
+#include "bench.h"
 #include "config.h"
 
 static double Mhz;  /* estimated CPU clock frequency */
@@ -36,6 +37,9 @@ void init_fsecs(void)
 #elif USE_GETTOD
     if (verbose)
 	printf("Measuring performance with gettimeofday().\n");
+#elif USE_BENCH
+    if (verbose)
+	printf("Measuring performance with the benchmark runner.\n");
 #endif
 }
 
@@ -51,6 +55,8 @@ double fsecs(fsecs_test_funct f, void *argp)
     return ftimer_itimer(f, argp, 10);
 #elif USE_GETTOD
     return ftimer_gettod(f, argp, 10);
+#elif USE_BENCH
+    return bench(f, argp, NULL);
 #endif 
 }
 
@@ -0,0 +1,389 @@
+/*
+ * gentrace.c - Generate synthetic .rep traces for mdriver
+ *
+ * Blocks are allocated one after another with sizes drawn from a size
+ * distribution. Each block lives for a number of allocations drawn from
+ * a lifetime distribution, after which it is freed. A fraction of the
+ * blocks grow while they live: they are reallocated at random times to
+ * a size growth times bigger. The live payload bytes never exceed the
+ * peak: when a new block would not fit, the blocks with the earliest
+ * pending event are freed early. All blocks still live after the last allocation are
+ * freed, so the trace is balanced.
+ *
+ * Pending frees and reallocs are kept in one min-heap ordered by time,
+ * so generating a trace of millions of ops takes O(n log n).
+ *
+ * usage: gentrace [options] > out.rep
+ *     -n <ops>     approximate number of requests (default 100000)
+ *     -s <dist>    size distribution, in bytes (default uniform:16:4096)
+ *                    uniform:<min>:<max>
+ *                    power:<min>:<max>:<alpha>   Pareto tail from min
+ *                    bimodal:<small>:<big>:<p>   big with probability p
+ *     -l <dist>    lifetime distribution, in allocations (default exp:1000)
+ *                    exp:<mean>
+ *                    uniform:<min>:<max>
+ *                    bimodal:<short>:<long>:<p>  long with probability p
+ *     -r <p>:<g>   a block grows with probability p, by g times per
+ *                  realloc (default 0:1.5, no reallocs)
+ *     -p <bytes>   peak live payload bytes (default 4194304)
+ *     -S <seed>    random seed (default 1)
+ *     -b           write a binary trace (see bintrace.h) instead of .rep
+ *
+ * Every distribution parameter may be a fraction, sizes are rounded to
+ * whole bytes (at least 1).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+
+#include "bintrace.h"
+
+#define MAXSIZE (1u << 30)  /* cap of any single request */
+
+/* The kinds of distributions */
+enum { UNIFORM, POWER, BIMODAL, EXP };
+
+typedef struct {
+    int kind;
+    double a, b, c;   /* parameters, in the order of the usage text */
+} dist_t;
+
+/* One pending event of a live block */
+typedef struct {
+    uint64_t time;    /* allocation count at which it happens */
+    int id;
+} event_t;
+
+/* One block, its next growth step or its free is pending in the heap */
+typedef struct {
+    unsigned size;    /* current payload size */
+    uint64_t death;   /* time of its free */
+} block_t;
+
+/* One output request */
+typedef struct {
+    char type;        /* 'a', 'r' or 'f' */
+    int id;
+    unsigned size;
+} repop_t;
+
+static event_t *heap;
+static int heap_len, heap_max;
+static block_t *blocks;
+static int num_ids, max_ids;
+static repop_t *ops;
+static long num_ops, max_ops;
+static uint64_t rng_state;
+
+static void parse_dist(char *arg, dist_t *d, int lifetime);
+static double draw(dist_t *d);
+static double uniform01(void);
+static void heap_push(uint64_t time, int id);
+static event_t heap_pop(void);
+static void emit(char type, int id, unsigned size);
+static void write_bin(long max_live);
+static void *grow(void *p, long *max, long want, size_t elem);
+static void usage(char *prog);
+
+int main(int argc, char **argv)
+{
+    dist_t size_dist, life_dist;
+    long target = 100000, peak = 4 << 20, live = 0, max_live = 0;
+    double grow_p = 0, grow_by = 1.5, d;
+    uint64_t now, next, seed = 1;
+    event_t e;
+    block_t *b;
+    unsigned size;
+    long i, maxids;
+    int c, id, binary = 0;
+
+    parse_dist("uniform:16:4096", &size_dist, 0);
+    parse_dist("exp:1000", &life_dist, 1);
+
+    while ((c = getopt(argc, argv, "n:s:l:r:p:S:bh")) != EOF) {
+	switch (c) {
+	case 'n':
+	    target = atol(optarg);
+	    break;
+	case 's':
+	    parse_dist(optarg, &size_dist, 0);
+	    break;
+	case 'l':
+	    parse_dist(optarg, &life_dist, 1);
+	    break;
+	case 'r':
+	    if (sscanf(optarg, "%lf:%lf", &grow_p, &grow_by) != 2
+		|| grow_p < 0 || grow_p > 1 || grow_by <= 1) {
+		fprintf(stderr, "gentrace: bad growth spec %s\n", optarg);
+		exit(1);
+	    }
+	    break;
+	case 'p':
+	    peak = atol(optarg);
+	    break;
+	case 'S':
+	    seed = strtoull(optarg, NULL, 0);
+	    break;
+	case 'b':
+	    binary = 1;
+	    break;
+	default:
+	    usage(argv[0]);
+	}
+    }
+    if (optind != argc || target < 2 || peak < 1)
+	usage(argv[0]);
+    rng_state = seed ? seed : 1;
+
+    /* Each allocation takes at least one more op to free it */
+    for (now = 0; num_ops < target - heap_len; now++) {
+	/* Retire everything that is due */
+	while (heap_len > 0 && heap[0].time <= now) {
+	    e = heap_pop();
+	    b = &blocks[e.id];
+	    if (e.time >= b->death) {
+		live -= b->size;
+		emit('f', e.id, 0);
+		continue;
+	    }
+	    /* A growth step, and the next one if the block still lives then */
+	    d = b->size * grow_by;
+	    size = (d > MAXSIZE) ? MAXSIZE : (unsigned)d;
+	    if (live + (long)size - (long)b->size <= peak) {
+		live += size - b->size;
+		b->size = size;
+		emit('r', e.id, size);
+	    }
+	    next = now + 1 + (uint64_t)(uniform01() * (b->death - now));
+	    heap_push((next < b->death) ? next : b->death, e.id);
+	}
+
+	/* The next block */
+	d = draw(&size_dist);
+	size = (d < 1) ? 1 : (d > MAXSIZE) ? MAXSIZE : (unsigned)(d + 0.5);
+	if (size > peak)
+	    size = peak;
+
+	/* Make room for it by freeing the blocks with the earliest events */
+	while (live + size > peak) {
+	    e = heap_pop();
+	    live -= blocks[e.id].size;
+	    emit('f', e.id, 0);
+	}
+
+	if (num_ids == max_ids) {
+	    maxids = max_ids;
+	    blocks = grow(blocks, &maxids, num_ids + 1, sizeof(block_t));
+	    max_ids = maxids;
+	}
+	id = num_ids++;
+	b = &blocks[id];
+	b->size = size;
+	b->death = now + 1 + (uint64_t)draw(&life_dist);
+	live += size;
+	if (live > max_live)
+	    max_live = live;
+	emit('a', id, size);
+
+	/* A growing block's first growth step comes before its free */
+	if (grow_p > 0 && uniform01() < grow_p && b->death > now + 1)
+	    heap_push(now + 1 + (uint64_t)(uniform01() * (b->death - now - 1)), id);
+	else
+	    heap_push(b->death, id);
+    }
+
+    /* Balance the trace, every live block has exactly one pending event */
+    while (heap_len > 0) {
+	e = heap_pop();
+	emit('f', e.id, 0);
+    }
+
+    if (binary) {
+	write_bin(max_live);
+	return 0;
+    }
+
+    /* The header: suggested heap size, ids, ops, weight */
+    printf("%ld\n%d\n%ld\n1\n", max_live, num_ids, num_ops);
+    for (i = 0; i < num_ops; i++) {
+	if (ops[i].type == 'f')
+	    printf("f %d\n", ops[i].id);
+	else
+	    printf("%c %d %u\n", ops[i].type, ops[i].id, ops[i].size);
+    }
+    return 0;
+}
+
+/*
+ * parse_dist - parse a "kind:param:..." distribution argument
+ */
+static void parse_dist(char *arg, dist_t *d, int lifetime)
+{
+    char kind[16] = ""; /* left alone if the spec has no name */
+    int n;
+
+    memset(d, 0, sizeof(*d));
+    n = sscanf(arg, "%15[a-z]:%lf:%lf:%lf", kind, &d->a, &d->b, &d->c);
+    if (!strcmp(kind, "uniform") && n == 3 && d->a <= d->b)
+	d->kind = UNIFORM;
+    else if (!strcmp(kind, "power") && n == 4 && !lifetime
+	     && d->a > 0 && d->a <= d->b && d->c > 0)
+	d->kind = POWER;
+    else if (!strcmp(kind, "bimodal") && n == 4 && d->c >= 0 && d->c <= 1)
+	d->kind = BIMODAL;
+    else if (!strcmp(kind, "exp") && n == 2 && lifetime && d->a > 0)
+	d->kind = EXP;
+    else {
+	fprintf(stderr, "gentrace: bad %s distribution %s\n",
+		lifetime ? "lifetime" : "size", arg);
+	exit(1);
+    }
+    if (d->a < 0 || d->b < 0) {
+	fprintf(stderr, "gentrace: negative parameter in %s\n", arg);
+	exit(1);
+    }
+}
+
+/*
+ * draw - one sample of the distribution
+ */
+static double draw(dist_t *d)
+{
+    double u = uniform01(), x;
+
+    switch (d->kind) {
+    case UNIFORM:
+	return d->a + u * (d->b - d->a);
+    case POWER: /* inverse of the Pareto CDF, cut at max */
+	x = d->a * pow(1.0 - u, -1.0 / d->c);
+	return (x > d->b) ? d->b : x;
+    case BIMODAL:
+	return (u < d->c) ? d->b : d->a;
+    case EXP:
+	return -d->a * log(1.0 - u);
+    }
+    return 0;
+}
+
+/*
+ * uniform01 - xorshift64* PRNG, a uniform double in [0, 1). The output
+ *     only depends on the seed, so a trace can be regenerated anywhere.
+ */
+static double uniform01(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return ((rng_state * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * heap_push - add an event to the min-heap on time
+ */
+static void heap_push(uint64_t time, int id)
+{
+    long max = heap_max;
+    int i, parent;
+
+    if (heap_len == heap_max) {
+	heap = grow(heap, &max, heap_len + 1, sizeof(event_t));
+	heap_max = max;
+    }
+    for (i = heap_len++; i > 0; i = parent) {
+	parent = (i - 1) / 2;
+	if (heap[parent].time <= time)
+	    break;
+	heap[i] = heap[parent];
+    }
+    heap[i].time = time;
+    heap[i].id = id;
+}
+
+/*
+ * heap_pop - remove and return the earliest event
+ */
+static event_t heap_pop(void)
+{
+    event_t top = heap[0], last = heap[--heap_len];
+    int i = 0, child;
+
+    while ((child = 2*i + 1) < heap_len) {
+	if (child + 1 < heap_len && heap[child+1].time < heap[child].time)
+	    child++;
+	if (last.time <= heap[child].time)
+	    break;
+	heap[i] = heap[child];
+	i = child;
+    }
+    heap[i] = last;
+    return top;
+}
+
+/*
+ * emit - append one request to the output
+ */
+static void emit(char type, int id, unsigned size)
+{
+    if (num_ops == max_ops)
+	ops = grow(ops, &max_ops, num_ops + 1, sizeof(repop_t));
+    ops[num_ops].type = type;
+    ops[num_ops].id = id;
+    ops[num_ops].size = size;
+    num_ops++;
+}
+
+/*
+ * write_bin - write the requests as a binary trace to stdout
+ */
+static void write_bin(long max_live)
+{
+    bintrace_hdr_t hdr;
+    traceop_t op;
+    long i;
+
+    if (num_ops > INT32_MAX) {
+	fprintf(stderr, "gentrace: too many requests for a binary trace\n");
+	exit(1);
+    }
+    hdr.magic = BINTRACE_MAGIC;
+    hdr.version = BINTRACE_VERSION;
+    hdr.sugg_heapsize = (max_live > INT32_MAX) ? INT32_MAX : max_live;
+    hdr.num_ids = num_ids;
+    hdr.num_ops = num_ops;
+    hdr.weight = 1;
+    fwrite(&hdr, sizeof(hdr), 1, stdout);
+    for (i = 0; i < num_ops; i++) {
+	op.type = (ops[i].type == 'a') ? ALLOC : (ops[i].type == 'r') ? REALLOC : FREE;
+	op.index = ops[i].id;
+	op.size = ops[i].size;
+	fwrite(&op, sizeof(op), 1, stdout);
+    }
+    if (fflush(stdout) != 0) {
+	perror("gentrace");
+	exit(1);
+    }
+}
+
+/*
+ * grow - double the capacity *max of array p until it holds want elements
+ */
+static void *grow(void *p, long *max, long want, size_t elem)
+{
+    while (*max < want)
+	*max = *max ? 2 * *max : 4096;
+    if ((p = realloc(p, *max * elem)) == NULL) {
+	perror("realloc");
+	exit(1);
+    }
+    return p;
+}
+
+static void usage(char *prog)
+{
+    fprintf(stderr, "usage: %s [-n <ops>] [-s <sizedist>] [-l <lifedist>] "
+	    "[-r <p>:<growth>] [-p <peakbytes>] [-S <seed>] [-b]\n", prog);
+    exit(1);
+}
@@ -0,0 +1,13 @@
+#
+# geo125.spec - finer size classes for mm.c, see sizeclass.spec
+#
+# Class upper bounds grow by 1.25x instead of 2x, which bounds the
+# slack between a request and the smallest block of its class to 25%.
+# Select it with "make CLASSSPEC=geo125.spec".
+#
+name   geo1.25
+min    24
+max    1048576
+ratio  1.25
+align  8
+lut    4096
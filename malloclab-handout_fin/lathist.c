@@ -0,0 +1,89 @@
+/*
+ * lathist.c - HDR-style latency histograms (see lathist.h)
+ */
+#include <string.h>
+#include <time.h>
+
+#include "lathist.h"
+
+#define LH_SUB (1 << LH_SUB_BITS)
+
+/*
+ * bucket_of - index of the bucket holding v. Values below LH_SUB map to
+ *     themselves, a value with its top bit at position m >= LH_SUB_BITS
+ *     keeps its LH_SUB_BITS bits below the top one.
+ */
+static int bucket_of(uint64_t v)
+{
+    int shift;
+
+    if (v < LH_SUB)
+	return (int)v;
+    shift = 63 - __builtin_clzll(v) - LH_SUB_BITS;
+    return ((shift + 1) << LH_SUB_BITS) + (int)((v >> shift) - LH_SUB);
+}
+
+/*
+ * bucket_hi - the largest value which falls into bucket idx
+ */
+static uint64_t bucket_hi(int idx)
+{
+    int shift = (idx >> LH_SUB_BITS) - 1;
+    uint64_t sub = idx & (LH_SUB - 1);
+
+    if (shift < 0)
+	return (uint64_t)idx;
+    return ((LH_SUB + sub + 1) << shift) - 1;
+}
+
+void lathist_reset(lathist_t *h)
+{
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+void lathist_record(lathist_t *h, uint64_t ns)
+{
+    h->bucket[bucket_of(ns)]++;
+    h->count++;
+    if (ns < h->min)
+	h->min = ns;
+    if (ns > h->max)
+	h->max = ns;
+}
+
+/*
+ * lathist_percentile - walk the buckets until pct percent of the values
+ *     are covered. The bound is clamped to the exact min and max, so
+ *     p0 and p100 are exact.
+ */
+uint64_t lathist_percentile(lathist_t *h, double pct)
+{
+    uint64_t want, seen = 0, hi;
+    int i;
+
+    if (h->count == 0)
+	return 0;
+    want = (uint64_t)(pct / 100.0 * h->count + 0.5);
+    if (want < 1)
+	want = 1;
+    for (i = 0; i < LH_BUCKETS; i++) {
+	seen += h->bucket[i];
+	if (seen >= want)
+	    break;
+    }
+    hi = bucket_hi(i);
+    if (hi > h->max)
+	hi = h->max;
+    if (hi < h->min)
+	hi = h->min;
+    return hi;
+}
+
+uint64_t lathist_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
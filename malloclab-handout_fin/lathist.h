@@ -0,0 +1,33 @@
+/*
+ * lathist.h - Latency histograms for mdriver
+ *
+ * A lathist_t counts latencies (in nanoseconds) in HDR-style log-linear
+ * buckets: values below 2^LH_SUB_BITS get one bucket each, and every
+ * higher power of two range is split into 2^LH_SUB_BITS equal buckets.
+ * Any reported percentile is thus within 1/2^LH_SUB_BITS (3%) of the
+ * exact value, over the whole 64 bit range, in a fixed size table.
+ */
+#ifndef __LATHIST_H_
+#define __LATHIST_H_
+
+#include <stdint.h>
+
+#define LH_SUB_BITS 5                      /* 32 buckets per power of two */
+#define LH_BUCKETS  ((64 - LH_SUB_BITS + 1) << LH_SUB_BITS)
+
+typedef struct {
+    uint64_t count;                /* number of recorded values */
+    uint64_t min, max;             /* exact extremes */
+    uint64_t bucket[LH_BUCKETS];   /* counts per log-linear bucket */
+} lathist_t;
+
+void lathist_reset(lathist_t *h);
+void lathist_record(lathist_t *h, uint64_t ns);
+
+/* The smallest bucket bound not exceeded by pct percent of the values */
+uint64_t lathist_percentile(lathist_t *h, double pct);
+
+/* Current CLOCK_MONOTONIC_RAW time in nanoseconds */
+uint64_t lathist_now(void);
+
+#endif /* __LATHIST_H_ */
@@ -14,12 +14,23 @@
 #include <string.h>
 #include <assert.h>
 #include <float.h>
+#include <stdint.h>
 #include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dlfcn.h>
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
 #include "config.h"
+#include "lathist.h"
+#include "bintrace.h"
+#include "perfctr.h"
+#include "bench.h"
 
 /**********************
  * Constants and macros
@@ -29,27 +40,33 @@
 #define MAXLINE     1024 /* max string size */
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+#define MAXTHREADS    64 /* max number of replay threads (-j) */
+#define MT_REPS        5 /* a -j replay is timed this many times, best is kept */
+#define LAT_REPS      10 /* a trace is replayed this many times for -H */
+#define PERF_REPS     10 /* ... and this many times under the counters (-P) */
+#define MAXBACKENDS    8 /* max number of allocator packages compared (-b) */
 
 /* Returns true if p is ALIGNMENT-byte aligned */
-#define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
+#define IS_ALIGNED(p)  ((((uintptr_t)(p)) % ALIGNMENT) == 0)
 
 /****************************** 
  * The key compound data types 
  *****************************/
 
-/* Records the extent of each block's payload */
+/* 
+ * Records the extent of each block's payload. The records form a treap 
+ * (a binary search tree on lo that is also a heap on prio), so finding, 
+ * adding and removing a payload takes O(log n) expected time. 
+ */
 typedef struct range_t {
     char *lo;              /* low payload address */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    unsigned prio;         /* random treap priority */
+    struct range_t *left;  /* payloads below lo */
+    struct range_t *right; /* payloads above hi */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
-typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
-    int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc/realloc request */
-} traceop_t;
+/* A single trace operation (traceop_t) is defined in bintrace.h */
 
 /* Holds the information for one trace file*/
 typedef struct {
@@ -60,6 +77,8 @@ typedef struct {
     traceop_t *ops;      /* array of requests */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    void *map;           /* mmapped binary trace holding ops (or NULL)... */
+    size_t map_len;      /* ... and its length */
 } trace_t;
 
 /* 
@@ -82,16 +101,90 @@ typedef struct {
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
 
+    /* defined only when timing with the benchmark runner (USE_BENCH) */
+    double ci95;     /* half width of the 95% confidence interval of secs */
+    int samples;     /* timed runs kept... */
+    int outliers;    /* ... and rejected */
+
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
 
+/* Summarizes a multi-threaded replay (-j) of some trace */
+typedef struct {
+    double ops;                 /* number of ops in the trace */
+    double secs;                /* wall clock secs of the fastest replay */
+    int nthreads;               /* number of replay threads */
+    double tops[MAXTHREADS];    /* ops replayed by each thread */
+    double tsecs[MAXTHREADS];   /* time spent by each thread in that replay */
+} mtstats_t;
+
+/* 
+ * An allocator package under test. A heap model package has the mm.h
+ * interface and gets its memory from memlib.c, so it's checked and
+ * measured like mm.c (validity, utilization, throughput). A native
+ * package has the libc interface and is treated like libc malloc
+ * (validity, throughput).
+ */
+typedef struct {
+    char *name;                  /* short name, used in the -O file */
+    char *desc;                  /* heading of its results */
+    int heapmodel;               /* mm.h interface on the memlib heap? */
+    int (*init)(void);           /* heap model packages only */
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size);
+    stats_t *stats;              /* its results, one per trace */
+    int errors;                  /* number of errs found when running it */
+} backend_t;
+
+/* Per-call latencies of the mm functions on some trace (-H) */
+typedef struct {
+    int valid;                  /* was the trace replayed? */
+    lathist_t hist[3];          /* indexed by the traceop_t type */
+} latstats_t;
+
+/* Hardware counter totals of the mm package on some trace (-P) */
+typedef struct {
+    int valid;                  /* was the trace replayed? */
+    double ops;                 /* ops replayed while counting */
+    double count[PC_NUM];       /* indexed like perfctr_name() */
+} perfstats_t;
+
+/* One replay thread: the ops of the trace whose block ids fall into its partition */
+typedef struct {
+    trace_t *trace;
+    int *ops;                   /* indices into trace->ops, in trace order */
+    int num_ops;
+    pthread_barrier_t *start;   /* all threads start replaying together */
+    double t0, t1;              /* wall clock start and end of this thread */
+    int owner;                  /* calls mm_init and owns the heap (MM_REMOTE_FREE) */
+    int *progress;              /* ops of the trace the owner is done with (MM_REMOTE_FREE) */
+    int *freed;                 /* frees the other threads are done with (MM_REMOTE_FREE) */
+} worker_t;
+
 /********************
  * Global variables
  *******************/
 int verbose = 0;        /* global flag for verbose output */
-static int errors = 0;  /* number of errs found when running student malloc */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
+/* The built-in packages: mm.c, linked into mdriver, and libc malloc */
+static backend_t mm_backend = {
+    "mm", "mm malloc", 1, mm_init, mm_malloc, mm_free, mm_realloc, NULL
+};
+static backend_t libc_backend = {
+    "libc", "libc malloc", 0, NULL, malloc, free, realloc, NULL
+};
+
+/* The package the eval_xxx routines are running */
+static backend_t *be = &mm_backend;
+
+/* Fragmentation timeline (-T): eval_mm_util samples the mm heap every
+   timeline_every ops of trace timeline_trace into timeline_fp */
+static FILE *timeline_fp = NULL;
+static int timeline_every = 0;
+static char *timeline_trace = NULL;
+
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
 
@@ -105,14 +198,19 @@ static char *default_tracefiles[] = {
  * Function prototypes 
  *********************/
 
-/* these functions manipulate range lists */
+/* these functions manipulate range trees */
 static int add_range(range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
+static range_t *find_range(range_t *t, char *addr);
+static range_t *insert_range(range_t *t, range_t *p);
+static range_t *delete_range(range_t *t, char *lo);
+static unsigned range_prio(void);
 
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
+static int map_trace(trace_t *trace, char *path);
 static void free_trace(trace_t *trace);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
@@ -122,11 +220,37 @@ static void eval_libc_speed(void *ptr);
 /* Routines for evaluating correctnes, space utilization, and speed 
    of the student's malloc package in mm.c */
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
+static int eval_mm_huge(int tracenum);
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
 static void eval_mm_speed(void *ptr);
+static void sample_heap(int opnum, int live_bytes);
+
+/* Multi-threaded replay of a trace against a thread-safe mm build (-j) */
+static void eval_mm_mt(trace_t *trace, int nthreads, mtstats_t *stats);
+static void *mt_worker(void *vargp);
+static double mt_now(void);
+
+/* Per-call latency histograms of the mm package (-H) */
+static void eval_mm_lat(trace_t *trace, latstats_t *stats);
+
+/* Hardware counters of the mm package (-P) */
+static void eval_mm_perf(speed_t *speed, perfstats_t *stats);
+
+/* Load an allocator package from a shared object (-b) */
+static backend_t *load_backend(char *path);
 
 /* Various helper routines */
-static void printresults(int n, stats_t *stats);
+static void keepbenchstats(stats_t *stats);
+static void writeresults(char *path, char **tracefiles, int n, 
+			 backend_t **backends, int nbackends, double perfindex);
+static void writestats(FILE *fp, int json, char *package, char *tracefile,
+		       stats_t *stats, int last);
+static void writejsonstr(FILE *fp, char *str);
+static void printresults(int n, stats_t *stats, int errors);
+static void printallresults(int n, backend_t **backends, int nbackends);
+static void printperfresults(int n, perfstats_t *stats);
+static void printlatresults(int n, latstats_t *stats);
+static void printmtresults(int n, mtstats_t *stats);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
@@ -143,13 +267,23 @@ int main(int argc, char **argv)
     int num_tracefiles = 0;    /* the number of traces in that array */
     trace_t *trace = NULL;     /* stores a single trace file in memory */
     range_t *ranges = NULL;    /* keeps track of block extents for one trace */
-    stats_t *libc_stats = NULL;/* libc stats for each trace */
     stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
+    backend_t *backends[MAXBACKENDS]; /* the packages to run, mm.c last */
+    char *libpaths[MAXBACKENDS];      /* shared objects to load (-b) */
+    int num_backends = 0, num_libs = 0, b;
+    mtstats_t *mt_stats = NULL;/* mm stats of the -j replay of each trace */
+    latstats_t *lat_stats = NULL; /* mm latencies of each trace (-H) */
+    perfstats_t *perf_stats = NULL; /* mm hardware counters of each trace (-P) */
     speed_t speed_params;      /* input parameters to the xx_speed routines */ 
 
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int nthreads = 0;    /* If set, also replay on this many threads (-j) */
+    int latency = 0;     /* If set, time every call of the mm package (-H) */
+    int perfctr = 0;     /* If set, read the hardware counters (-P) */
+    char *outfile = NULL;/* If set, write the results to this file (-O) */
+    char *timeline = "timeline.csv"; /* Fragmentation timeline file (-T) */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -158,7 +292,7 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:j:R:W:C:O:T:b:hvVgalkHP")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -184,6 +318,49 @@ int main(int argc, char **argv)
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'H': /* Latency histograms of every mm call */
+            latency = 1;
+            break;
+        case 'P': /* Hardware counters around the mm speed runs */
+            perfctr = 1;
+            break;
+        case 'b': /* Run an allocator package from a shared object */
+            if (num_libs == MAXBACKENDS - 2)
+                app_error("ERROR: too many -b packages");
+            libpaths[num_libs++] = optarg;
+            break;
+        case 'R': /* Timed runs per measurement */
+            set_bench_reps(atoi(optarg));
+            break;
+        case 'W': /* Untimed warmup runs per measurement */
+            set_bench_warmup(atoi(optarg));
+            break;
+        case 'k': /* Keep the outlier runs of every measurement */
+            set_bench_outliers(0);
+            break;
+        case 'C': /* Pin to this CPU */
+            if (set_bench_cpu(atoi(optarg)) < 0)
+		unix_error("Can't pin mdriver to the -C CPU");
+            break;
+        case 'O': /* Machine readable results */
+            outfile = optarg;
+            break;
+        case 'T': /* Fragmentation timeline, -T <n>[:<file>] */
+            timeline_every = atoi(optarg);
+            if (timeline_every < 1) {
+                fprintf(stderr, "-T takes a sample period of at least 1 op\n");
+                exit(1);
+            }
+            if (strchr(optarg, ':'))
+                timeline = strchr(optarg, ':') + 1;
+            break;
+        case 'j': /* Replay each trace on this many threads as well */
+            nthreads = atoi(optarg);
+            if (nthreads < 1 || nthreads > MAXTHREADS) {
+                fprintf(stderr, "-j takes 1 to %d threads\n", MAXTHREADS);
+                exit(1);
+            }
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -225,6 +402,22 @@ int main(int argc, char **argv)
 	    printf("Member 2 :%s:%s\n", team.name2, team.id2);
     }
 
+#if !defined(MM_THREADSAFE) && !defined(MM_REMOTE_FREE)
+    /* Only the thread-safe build of mm.c may be called concurrently */
+    if (nthreads > 1)
+	app_error("ERROR: -j needs the thread-safe build of mm.c (make mdriver-mt or mdriver-remote)");
+#endif
+
+    /* The counters may be missing (no PMU, a VM, perf_event_paranoid) */
+    if (perfctr && perfctr_open() == 0) {
+	printf("No hardware counters available, ignoring -P\n");
+	perfctr = 0;
+    }
+
+    /* Report which size class table was compiled into mm.c */
+    if (verbose)
+	printf("Size classes: %s\n", mm_sizeclass);
+
     /* 
      * If no -f command line arg, then use the entire set of tracefiles 
      * defined in default_traces[]
@@ -238,79 +431,125 @@ int main(int argc, char **argv)
     /* Initialize the timing package */
     init_fsecs();
 
-    /*
-     * Optionally run and evaluate the libc malloc package 
+    /* 
+     * Optionally run libc malloc and the -b packages, then always the
+     * student's mm package
      */
-    if (run_libc) {
+    if (run_libc)
+	backends[num_backends++] = &libc_backend;
+    for (i = 0; i < num_libs; i++)
+	backends[num_backends++] = load_backend(libpaths[i]);
+    backends[num_backends++] = &mm_backend;
+
+    /* The extra measurements are only made for the student's mm package */
+    if (nthreads && 
+	(mt_stats = (mtstats_t *)calloc(num_tracefiles, sizeof(mtstats_t))) == NULL)
+	unix_error("mt_stats calloc in main failed");
+    if (latency && 
+	(lat_stats = (latstats_t *)calloc(num_tracefiles, sizeof(latstats_t))) == NULL)
+	unix_error("lat_stats calloc in main failed");
+    if (perfctr && 
+	(perf_stats = (perfstats_t *)calloc(num_tracefiles, sizeof(perfstats_t))) == NULL)
+	unix_error("perf_stats calloc in main failed");
+    
+    /* Initialize the simulated memory system in memlib.c */
+    mem_init(); 
+
+    if (timeline_every) {
+	if ((timeline_fp = fopen(timeline, "w")) == NULL)
+	    unix_error("Can't open the -T timeline file");
+	fprintf(timeline_fp, "trace,op,live_bytes,heap_bytes,free_blocks,"
+		"free_bytes,largest_free,util,frag\n");
+    }
+
+    for (b = 0; b < num_backends; b++) {
+	be = backends[b];
 	if (verbose > 1)
-	    printf("\nTesting libc malloc\n");
-	
-	/* Allocate libc stats array, with one stats_t struct per tracefile */
-	libc_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
-	if (libc_stats == NULL)
-	    unix_error("libc_stats calloc in main failed");
-	
-	/* Evaluate the libc malloc package using the K-best scheme */
+	    printf("\nTesting %s\n", be->desc);
+
+	/* Allocate the stats array, with one stats_t struct per tracefile */
+	be->stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
+	if (be->stats == NULL)
+	    unix_error("stats calloc in main failed");
+
+	/* Evaluate the package using the timing package of config.h */
 	for (i=0; i < num_tracefiles; i++) {
 	    trace = read_trace(tracedir, tracefiles[i]);
-	    libc_stats[i].ops = trace->num_ops;
+	    be->stats[i].ops = trace->num_ops;
 	    if (verbose > 1)
-		printf("Checking libc malloc for correctness, ");
-	    libc_stats[i].valid = eval_libc_valid(trace, i);
-	    if (libc_stats[i].valid) {
+		printf("Checking %s for correctness, ", be->desc);
+	    if (!be->heapmodel) {
+		be->stats[i].valid = eval_libc_valid(trace, i);
+		if (be->stats[i].valid) {
+		    speed_params.trace = trace;
+		    if (verbose > 1)
+			printf("and performance.\n");
+		    be->stats[i].secs = fsecs(eval_libc_speed, &speed_params);
+		    keepbenchstats(&be->stats[i]);
+		}
+		free_trace(trace);
+		continue;
+	    }
+	    be->stats[i].valid = eval_mm_valid(trace, i, &ranges);
+	    if (be->stats[i].valid) {
+		if (verbose > 1)
+		    printf("efficiency, ");
+		timeline_trace = (be == &mm_backend && timeline_fp) ?
+		    tracefiles[i] : NULL;
+		be->stats[i].util = eval_mm_util(trace, i, &ranges);
+		timeline_trace = NULL;
 		speed_params.trace = trace;
+		speed_params.ranges = ranges;
 		if (verbose > 1)
 		    printf("and performance.\n");
-		libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
+		be->stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+		keepbenchstats(&be->stats[i]);
+		if (be == &mm_backend && nthreads)
+		    eval_mm_mt(trace, nthreads, &mt_stats[i]);
+		if (be == &mm_backend && latency)
+		    eval_mm_lat(trace, &lat_stats[i]);
+		if (be == &mm_backend && perfctr)
+		    eval_mm_perf(&speed_params, &perf_stats[i]);
 	    }
 	    free_trace(trace);
 	}
 
-	/* Display the libc results in a compact table */
-	if (verbose) {
-	    printf("\nResults for libc malloc:\n");
-	    printresults(num_tracefiles, libc_stats);
+	/* Display the results of all but mm malloc in a compact table */
+	if (verbose && be != &mm_backend) {
+	    printf("\nResults for %s:\n", be->desc);
+	    printresults(num_tracefiles, be->stats, be->errors);
 	}
     }
+    mm_stats = mm_backend.stats;
 
-    /*
-     * Always run and evaluate the student's mm package
-     */
-    if (verbose > 1)
-	printf("\nTesting mm malloc\n");
+    /* Display the mm results in a compact table */
+    if (verbose) {
+	printf("\nResults for mm malloc:\n");
+	printresults(num_tracefiles, mm_stats, mm_backend.errors);
+	printf("\n");
+    }
 
-    /* Allocate the mm stats array, with one stats_t struct per tracefile */
-    mm_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
-    if (mm_stats == NULL)
-	unix_error("mm_stats calloc in main failed");
-    
-    /* Initialize the simulated memory system in memlib.c */
-    mem_init(); 
+    /* The comparison and the extra measurements aren't graded */
+    if (num_backends > 1) {
+	printf("Results for all packages (util, Kops):\n");
+	printallresults(num_tracefiles, backends, num_backends);
+	printf("\n");
+    }
+    if (perfctr) {
+	printf("Hardware counters per op of mm malloc:\n");
+	printperfresults(num_tracefiles, perf_stats);
+	printf("\n");
+    }
 
-    /* Evaluate student's mm malloc package using the K-best scheme */
-    for (i=0; i < num_tracefiles; i++) {
-	trace = read_trace(tracedir, tracefiles[i]);
-	mm_stats[i].ops = trace->num_ops;
-	if (verbose > 1)
-	    printf("Checking mm_malloc for correctness, ");
-	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-	if (mm_stats[i].valid) {
-	    if (verbose > 1)
-		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
-	    speed_params.trace = trace;
-	    speed_params.ranges = ranges;
-	    if (verbose > 1)
-		printf("and performance.\n");
-	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
-	}
-	free_trace(trace);
+    if (latency) {
+	printf("Latency of mm malloc calls in ns:\n");
+	printlatresults(num_tracefiles, lat_stats);
+	printf("\n");
     }
 
-    /* Display the mm results in a compact table */
-    if (verbose) {
-	printf("\nResults for mm malloc:\n");
-	printresults(num_tracefiles, mm_stats);
+    if (nthreads) {
+	printf("Results for mm malloc on %d threads:\n", nthreads);
+	printmtresults(num_tracefiles, mt_stats);
 	printf("\n");
     }
 
@@ -333,7 +572,7 @@ int main(int argc, char **argv)
     /* 
      * Compute and print the performance index 
      */
-    if (errors == 0) {
+    if (mm_backend.errors == 0) {
 	avg_mm_throughput = ops/secs;
 
 	p1 = UTIL_WEIGHT * avg_mm_util;
@@ -354,7 +593,15 @@ int main(int argc, char **argv)
     }
     else { /* There were errors */
 	perfindex = 0.0;
-	printf("Terminated with %d errors\n", errors);
+	printf("Terminated with %d errors\n", mm_backend.errors);
+    }
+
+    if (outfile)
+	writeresults(outfile, tracefiles, num_tracefiles, 
+		     backends, num_backends, perfindex);
+    if (timeline_fp) {
+	fclose(timeline_fp);
+	printf("Fragmentation timeline written to %s\n", timeline);
     }
 
     if (autograder) {
@@ -367,16 +614,16 @@ int main(int argc, char **argv)
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps 
+ * The following routines manipulate the range tree, which keeps 
  * track of the extent of every allocated block payload. We use the 
- * range list to detect any overlapping allocated blocks.
+ * range tree to detect any overlapping allocated blocks.
  ****************************************************************/
 
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of 
  *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list. 
+ *     we create a range struct for this block and add it to the range tree. 
  */
 static int add_range(range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum)
@@ -404,27 +651,29 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-	    sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-		    lo, hi, p->lo, p->hi);
-	    malloc_error(tracenum, opnum, msg);
-	    return 0;
-        }
+    /* 
+     * The payload must not overlap any other payloads. The payloads in 
+     * the tree are disjoint, so of those starting at or below hi, the 
+     * one starting last also ends last: it's the only one to check.
+     */
+    if ((p = find_range(*ranges, hi)) != NULL && p->hi >= lo) {
+	sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+		lo, hi, p->lo, p->hi);
+	malloc_error(tracenum, opnum, msg);
+	return 0;
     }
 
     /* 
      * Everything looks OK, so remember the extent of this block 
-     * by creating a range struct and adding it the range list.
+     * by creating a range struct and adding it the range tree.
      */
     if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
 	unix_error("malloc error in add_range");
-    p->next = *ranges;
     p->lo = lo;
     p->hi = hi;
-    *ranges = p;
+    p->prio = range_prio();
+    p->left = p->right = NULL;
+    *ranges = insert_range(*ranges, p);
     return 1;
 }
 
@@ -433,19 +682,7 @@ static int add_range(range_t **ranges, char *lo, int size,
  */
 static void remove_range(range_t **ranges, char *lo)
 {
-    range_t *p;
-    range_t **prevpp = ranges;
-    int size;
-
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-	    *prevpp = p->next;
-            size = p->hi - p->lo + 1;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
-    }
+    *ranges = delete_range(*ranges, lo);
 }
 
 /*
@@ -453,16 +690,112 @@ static void remove_range(range_t **ranges, char *lo)
  */
 static void clear_ranges(range_t **ranges)
 {
-    range_t *p;
-    range_t *pnext;
+    range_t *p = *ranges;
 
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
-    }
+    if (p == NULL)
+	return;
+    clear_ranges(&p->left);
+    clear_ranges(&p->right);
+    free(p);
     *ranges = NULL;
 }
 
+/*
+ * find_range - return the range with the largest lo <= addr (or NULL)
+ */
+static range_t *find_range(range_t *t, char *addr)
+{
+    range_t *best = NULL;
+
+    while (t != NULL) {
+	if (t->lo <= addr) {
+	    best = t;
+	    t = t->right;
+	}
+	else
+	    t = t->left;
+    }
+    return best;
+}
+
+/*
+ * insert_range - insert range p into treap t and return the new root
+ */
+static range_t *insert_range(range_t *t, range_t *p)
+{
+    range_t *c;
+
+    if (t == NULL)
+	return p;
+    if (p->lo < t->lo) {
+	t->left = insert_range(t->left, p);
+	if (t->left->prio > t->prio) {   /* rotate right */
+	    c = t->left;
+	    t->left = c->right;
+	    c->right = t;
+	    return c;
+	}
+    }
+    else {
+	t->right = insert_range(t->right, p);
+	if (t->right->prio > t->prio) {  /* rotate left */
+	    c = t->right;
+	    t->right = c->left;
+	    c->left = t;
+	    return c;
+	}
+    }
+    return t;
+}
+
+/*
+ * delete_range - remove and free the range starting at lo from treap t 
+ *     and return the new root
+ */
+static range_t *delete_range(range_t *t, char *lo)
+{
+    range_t *c;
+
+    if (t == NULL)
+	return NULL;
+    if (lo < t->lo)
+	t->left = delete_range(t->left, lo);
+    else if (lo > t->lo)
+	t->right = delete_range(t->right, lo);
+    else if (t->left == NULL || t->right == NULL) {
+	c = (t->left != NULL) ? t->left : t->right;
+	free(t);
+	return c;
+    }
+    else if (t->left->prio > t->right->prio) { /* rotate right, go on */
+	c = t->left;
+	t->left = c->right;
+	c->right = delete_range(t, lo);
+	return c;
+    }
+    else {                                      /* rotate left, go on */
+	c = t->right;
+	t->right = c->left;
+	c->left = delete_range(t, lo);
+	return c;
+    }
+    return t;
+}
+
+/*
+ * range_prio - pseudo random treap priorities (xorshift, so runs are
+ *     reproducible and the student's use of rand() is not disturbed)
+ */
+static unsigned range_prio(void)
+{
+    static unsigned x = 2463534242u;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+}
+
 
 /**********************************************
  * The following routines manipulate tracefiles
@@ -473,7 +806,7 @@ static void clear_ranges(range_t **ranges)
  */
 static trace_t *read_trace(char *tracedir, char *filename)
 {
-    FILE *tracefile;
+    FILE *tracefile = NULL;
     trace_t *trace;
     char type[MAXLINE];
     char path[MAXLINE];
@@ -491,19 +824,22 @@ static trace_t *read_trace(char *tracedir, char *filename)
     /* Read the trace file header */
     strcpy(path, tracedir);
     strcat(path, filename);
-    if ((tracefile = fopen(path, "r")) == NULL) {
-	sprintf(msg, "Could not open %s in read_trace", path);
-	unix_error(msg);
-    }
-    fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
-    fscanf(tracefile, "%d", &(trace->num_ids));     
-    fscanf(tracefile, "%d", &(trace->num_ops));     
-    fscanf(tracefile, "%d", &(trace->weight));        /* not used */
+    trace->map = NULL;
+    if (!map_trace(trace, path)) {
+	if ((tracefile = fopen(path, "r")) == NULL) {
+	    sprintf(msg, "Could not open %s in read_trace", path);
+	    unix_error(msg);
+	}
+	fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
+	fscanf(tracefile, "%d", &(trace->num_ids));     
+	fscanf(tracefile, "%d", &(trace->num_ops));     
+	fscanf(tracefile, "%d", &(trace->weight));        /* not used */
     
-    /* We'll store each request line in the trace in this array */
-    if ((trace->ops = 
-	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
-	unix_error("malloc 2 failed in read_trace");
+	/* We'll store each request line in the trace in this array */
+	if ((trace->ops = 
+	     (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
+	    unix_error("malloc 2 failed in read_trace");
+    }
 
     /* We'll keep an array of pointers to the allocated blocks here... */
     if ((trace->blocks = 
@@ -514,6 +850,10 @@ static trace_t *read_trace(char *tracedir, char *filename)
     if ((trace->block_sizes = 
 	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
 	unix_error("malloc 4 failed in read_trace");
+
+    /* A binary trace needs no parsing */
+    if (trace->map)
+	return trace;
     
     /* read every request line in the trace file */
     index = 0;
@@ -554,12 +894,64 @@ static trace_t *read_trace(char *tracedir, char *filename)
     return trace;
 }
 
+/*
+ * map_trace - If path is a binary trace (see bintrace.h), mmap it and
+ *     point trace->ops at its records in place. Returns 0 for a text
+ *     trace. The header, the file length and every record's type, id
+ *     and size are checked before any of it is replayed.
+ */
+static int map_trace(trace_t *trace, char *path)
+{
+    bintrace_hdr_t hdr;
+    struct stat st;
+    traceop_t *op;
+    int fd, i;
+
+    if ((fd = open(path, O_RDONLY)) < 0) 
+	return 0; /* let read_trace report it */
+    if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) 
+	|| hdr.magic != BINTRACE_MAGIC) {
+	close(fd);
+	return 0;
+    }
+    if (hdr.version != BINTRACE_VERSION || hdr.num_ops < 0 || hdr.num_ids < 0
+	|| fstat(fd, &st) < 0 
+	|| st.st_size != sizeof(hdr) + (off_t)hdr.num_ops * sizeof(traceop_t)) {
+	printf("Bad binary trace %s\n", path);
+	exit(1);
+    }
+    trace->map_len = st.st_size;
+    trace->map = mmap(NULL, trace->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (trace->map == MAP_FAILED)
+	unix_error("mmap failed in map_trace");
+    close(fd);
+    madvise(trace->map, trace->map_len, MADV_SEQUENTIAL);
+
+    trace->sugg_heapsize = hdr.sugg_heapsize;
+    trace->num_ids = hdr.num_ids;
+    trace->num_ops = hdr.num_ops;
+    trace->weight = hdr.weight;
+    trace->ops = (traceop_t *)((char *)trace->map + sizeof(hdr));
+
+    for (i = 0, op = trace->ops; i < trace->num_ops; i++, op++)
+	if (op->index < 0 || op->index >= trace->num_ids || op->size < 0
+	    || (op->type != ALLOC && op->type != FREE && op->type != REALLOC)) {
+	    printf("Bad binary trace %s (record %d)\n", path, i);
+	    exit(1);
+	}
+    return 1;
+}
+
 /*
  * free_trace - Free the trace record and the three arrays it points
  *              to, all of which were allocated in read_trace().
  */
 void free_trace(trace_t *trace)
 {
+    if (trace->map) {         /* a binary trace's ops are mmapped */
+	munmap(trace->map, trace->map_len);
+	trace->ops = NULL;
+    }
     free(trace->ops);         /* free the three arrays... */
     free(trace->blocks);      
     free(trace->block_sizes);
@@ -589,10 +981,12 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
     clear_ranges(ranges);
 
     /* Call the mm package's init function */
-    if (mm_init() < 0) {
+    if (be->init() < 0) {
 	malloc_error(tracenum, 0, "mm_init failed.");
 	return 0;
     }
+    if (!eval_mm_huge(tracenum))
+	return 0;
 
     /* Interpret each operation in the trace in order */
     for (i = 0;  i < trace->num_ops;  i++) {
@@ -604,7 +998,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
         case ALLOC: /* mm_malloc */
 
 	    /* Call the student's malloc */
-	    if ((p = mm_malloc(size)) == NULL) {
+	    if ((p = be->malloc(size)) == NULL) {
 		malloc_error(tracenum, i, "mm_malloc failed.");
 		return 0;
 	    }
@@ -633,7 +1027,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    
 	    /* Call the student's realloc */
 	    oldp = trace->blocks[index];
-	    if ((newp = mm_realloc(oldp, size)) == NULL) {
+	    if ((newp = be->realloc(oldp, size)) == NULL) {
 		malloc_error(tracenum, i, "mm_realloc failed.");
 		return 0;
 	    }
@@ -653,7 +1047,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 	    if (size < oldsize) oldsize = size;
 	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
+	      if ((unsigned char)newp[j] != (index & 0xFF)) {
 		malloc_error(tracenum, i, "mm_realloc did not preserve the "
 			     "data from old block");
 		return 0;
@@ -671,7 +1065,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    /* Remove region from list and call student's free function */
 	    p = trace->blocks[index];
 	    remove_range(ranges, p);
-	    mm_free(p);
+	    be->free(p);
 	    break;
 
 	default:
@@ -684,6 +1078,32 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
     return 1;
 }
 
+/*
+ * eval_mm_huge - A request too big for a 32-bit block size (4 GB and up
+ *     with a 64-bit size_t) must fail, or get a block that really lies
+ *     in the heap and isn't handed out again. A package that truncates
+ *     the size returns a small block instead.
+ */
+static int eval_mm_huge(int tracenum)
+{
+    size_t size = (SIZE_MAX > UINT32_MAX) ? (size_t)UINT32_MAX + 65 : (size_t)UINT32_MAX - 15;
+    char *p, *q;
+
+    if ((p = be->malloc(size)) == NULL)
+	return 1;
+    if (p < (char *)mem_heap_lo() || (size_t)((char *)mem_heap_hi() - p) < size - 1) {
+	malloc_error(tracenum, 0, "mm_malloc of 4 GB returned a block beyond the heap.");
+	return 0;
+    }
+    if ((q = be->malloc(100)) != NULL && q + 100 > p && q < p + size) {
+	malloc_error(tracenum, 0, "mm_malloc returned a block inside a 4 GB block.");
+	return 0;
+    }
+    be->free(q);
+    be->free(p);
+    return 1;
+}
+
 /* 
  * eval_mm_util - Evaluate the space utilization of the student's package
  *   The idea is to remember the high water mark "hwm" of the heap for 
@@ -707,7 +1127,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 
     /* initialize the heap and the mm malloc package */
     mem_reset_brk();
-    if (mm_init() < 0)
+    if (be->init() < 0)
 	app_error("mm_init failed in eval_mm_util");
 
     for (i = 0;  i < trace->num_ops;  i++) {
@@ -717,7 +1137,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    index = trace->ops[i].index;
 	    size = trace->ops[i].size;
 
-	    if ((p = mm_malloc(size)) == NULL) 
+	    if ((p = be->malloc(size)) == NULL) 
 		app_error("mm_malloc failed in eval_mm_util");
 	    
 	    /* Remember region and size */
@@ -739,7 +1159,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 
 	    oldp = trace->blocks[index];
-	    if ((newp = mm_realloc(oldp,newsize)) == NULL)
+	    if ((newp = be->realloc(oldp,newsize)) == NULL)
 		app_error("mm_realloc failed in eval_mm_util");
 
 	    /* Remember region and size */
@@ -760,7 +1180,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    size = trace->block_sizes[index];
 	    p = trace->blocks[index];
 	    
-	    mm_free(p);
+	    be->free(p);
 	    
 	    /* Keep track of current total size
 	     * of all allocated blocks */
@@ -772,12 +1192,35 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    app_error("Nonexistent request type in eval_mm_util");
 
         }
+	if (timeline_trace && 
+	    ((i+1) % timeline_every == 0 || i == trace->num_ops - 1))
+	    sample_heap(i+1, total_size);
     }
 
     return ((double)max_total_size / (double)mem_heapsize());
 }
 
 
+/*
+ * sample_heap - Append one point of the fragmentation timeline: the
+ *   live payload bytes and the heap size after opnum ops, and the free
+ *   blocks mm.c reports. util is live/heap, frag is the share of free
+ *   bytes outside the largest free block (0 = one big hole).
+ */
+static void sample_heap(int opnum, int live_bytes)
+{
+    mm_heapstats_t hs;
+    size_t heap = mem_heapsize();
+
+    mm_heapstats(&hs);
+    fprintf(timeline_fp, "%s,%d,%d,%lu,%lu,%lu,%lu,%.4f,%.4f\n",
+	    timeline_trace, opnum, live_bytes, (unsigned long)heap,
+	    (unsigned long)hs.free_blocks, (unsigned long)hs.free_bytes,
+	    (unsigned long)hs.largest_free,
+	    heap ? (double)live_bytes / heap : 0.0,
+	    hs.free_bytes ? 1.0 - (double)hs.largest_free / hs.free_bytes : 0.0);
+}
+
 /*
  * eval_mm_speed - This is the function that is used by fcyc()
  *    to measure the running time of the mm malloc package.
@@ -790,7 +1233,7 @@ static void eval_mm_speed(void *ptr)
 
     /* Reset the heap and initialize the mm package */
     mem_reset_brk();
-    if (mm_init() < 0) 
+    if (be->init() < 0) 
 	app_error("mm_init failed in eval_mm_speed");
 
     /* Interpret each trace request */
@@ -800,7 +1243,7 @@ static void eval_mm_speed(void *ptr)
         case ALLOC: /* mm_malloc */
             index = trace->ops[i].index;
             size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
+            if ((p = be->malloc(size)) == NULL)
 		app_error("mm_malloc error in eval_mm_speed");
             trace->blocks[index] = p;
             break;
@@ -809,7 +1252,7 @@ static void eval_mm_speed(void *ptr)
 	    index = trace->ops[i].index;
             newsize = trace->ops[i].size;
 	    oldp = trace->blocks[index];
-            if ((newp = mm_realloc(oldp,newsize)) == NULL)
+            if ((newp = be->realloc(oldp,newsize)) == NULL)
 		app_error("mm_realloc error in eval_mm_speed");
             trace->blocks[index] = newp;
             break;
@@ -817,7 +1260,7 @@ static void eval_mm_speed(void *ptr)
         case FREE: /* mm_free */
             index = trace->ops[i].index;
             block = trace->blocks[index];
-            mm_free(block);
+            be->free(block);
             break;
 
 	default:
@@ -825,6 +1268,253 @@ static void eval_mm_speed(void *ptr)
         }
 }
 
+/*
+ * eval_mm_mt - Replay the trace on nthreads threads at once. The ops
+ *    are partitioned by block id (id % nthreads), so every block is
+ *    allocated, resized and freed by one thread in trace order while
+ *    the threads share the heap. The fastest of MT_REPS replays is kept.
+ *
+ *    With MM_REMOTE_FREE only the heap owner may allocate, so thread 0
+ *    owns the heap and replays every mm_malloc and mm_realloc, and the
+ *    frees are partitioned among the other threads by block id. A free
+ *    waits until the owner is past it in the trace, and then goes
+ *    through the remote stack of mm.c. The owner waits in turn for the
+ *    frees before each of its ops, so the heap never holds more live
+ *    blocks than the trace does.
+ */
+static void eval_mm_mt(trace_t *trace, int nthreads, mtstats_t *stats)
+{
+    pthread_t tid[MAXTHREADS];
+    worker_t w[MAXTHREADS];
+    pthread_barrier_t start;
+    double t0, t1;
+    int i, k, rep;
+#ifdef MM_REMOTE_FREE
+    int progress, freed;
+#endif
+
+    /* Split the trace into the partitions */
+    for (k = 0; k < nthreads; k++) {
+	w[k].trace = trace;
+	w[k].num_ops = 0;
+	w[k].start = &start;
+	w[k].owner = 0;
+	w[k].progress = NULL;
+	w[k].freed = NULL;
+	if ((w[k].ops = (int *)malloc(trace->num_ops * sizeof(int))) == NULL)
+	    unix_error("malloc failed in eval_mm_mt");
+    }
+    for (i = 0; i < trace->num_ops; i++) {
+#ifdef MM_REMOTE_FREE
+	if (trace->ops[i].type != FREE || nthreads == 1)
+	    k = 0;
+	else
+	    k = 1 + trace->ops[i].index % (nthreads - 1);
+#else
+	k = trace->ops[i].index % nthreads;
+#endif
+	w[k].ops[w[k].num_ops++] = i;
+    }
+#ifdef MM_REMOTE_FREE
+    w[0].owner = 1;
+    for (k = 0; k < nthreads; k++) {
+	w[k].progress = &progress;
+	w[k].freed = &freed;
+    }
+#endif
+
+    stats->ops = trace->num_ops;
+    stats->secs = DBL_MAX;
+    stats->nthreads = nthreads;
+    for (rep = 0; rep < MT_REPS; rep++) {
+	/* Reset the heap and initialize the mm package (unless a thread owns it) */
+	mem_reset_brk();
+	if (!w[0].owner && mm_init() < 0)
+	    app_error("mm_init failed in eval_mm_mt");
+#ifdef MM_REMOTE_FREE
+	progress = freed = 0;
+#endif
+
+	/* 
+	 * The replay lasts from the first thread's start to the last
+	 * thread's end, the main thread may not even run in between.
+	 */
+	if (pthread_barrier_init(&start, NULL, nthreads) != 0)
+	    app_error("pthread_barrier_init failed in eval_mm_mt");
+	for (k = 0; k < nthreads; k++)
+	    if (pthread_create(&tid[k], NULL, mt_worker, &w[k]) != 0)
+		app_error("pthread_create failed in eval_mm_mt");
+	for (k = 0; k < nthreads; k++)
+	    pthread_join(tid[k], NULL);
+	pthread_barrier_destroy(&start);
+	t0 = DBL_MAX;
+	t1 = 0;
+	for (k = 0; k < nthreads; k++) {
+	    if (w[k].t0 < t0)
+		t0 = w[k].t0;
+	    if (w[k].t1 > t1)
+		t1 = w[k].t1;
+	}
+
+	if (t1 - t0 < stats->secs) {
+	    stats->secs = t1 - t0;
+	    for (k = 0; k < nthreads; k++) {
+		stats->tops[k] = w[k].num_ops;
+		stats->tsecs[k] = w[k].t1 - w[k].t0;
+	    }
+	}
+    }
+
+    for (k = 0; k < nthreads; k++)
+	free(w[k].ops);
+}
+
+/*
+ * mt_worker - Replay one partition of a trace (see eval_mm_mt)
+ */
+static void *mt_worker(void *vargp)
+{
+    worker_t *w = (worker_t *)vargp;
+    trace_t *trace = w->trace;
+    traceop_t *op;
+    char *p;
+    int i, scan = 0, nfree = 0;
+
+    if (w->owner && mm_init() < 0)
+	app_error("mm_init failed in eval_mm_mt");
+    pthread_barrier_wait(w->start);
+    w->t0 = mt_now();
+    for (i = 0; i < w->num_ops; i++) {
+	op = &trace->ops[w->ops[i]];
+	if (w->owner) {
+	    __atomic_store_n(w->progress, w->ops[i], __ATOMIC_RELEASE);
+	    for (; scan < w->ops[i]; scan++)
+		nfree += (trace->ops[scan].type == FREE);
+	    while (__atomic_load_n(w->freed, __ATOMIC_ACQUIRE) < nfree)
+		sched_yield(); /* the frees before this op aren't done yet */
+	}
+	else if (w->progress)
+	    while (__atomic_load_n(w->progress, __ATOMIC_ACQUIRE) <= w->ops[i])
+		sched_yield(); /* the owner hasn't allocated this block yet */
+	switch (op->type) {
+
+	case ALLOC: /* mm_malloc */
+	    if ((p = mm_malloc(op->size)) == NULL)
+		app_error("mm_malloc error in eval_mm_mt");
+	    trace->blocks[op->index] = p;
+	    break;
+
+	case REALLOC: /* mm_realloc */
+	    if ((p = mm_realloc(trace->blocks[op->index], op->size)) == NULL)
+		app_error("mm_realloc error in eval_mm_mt");
+	    trace->blocks[op->index] = p;
+	    break;
+
+	case FREE: /* mm_free */
+	    mm_free(trace->blocks[op->index]);
+	    if (w->freed)
+		__atomic_add_fetch(w->freed, 1, __ATOMIC_RELEASE);
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_mt");
+	}
+    }
+    if (w->owner)
+	__atomic_store_n(w->progress, trace->num_ops, __ATOMIC_RELEASE);
+    w->t1 = mt_now();
+    return NULL;
+}
+
+/*
+ * mt_now - Wall clock time in secs
+ */
+static double mt_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * eval_mm_lat - Time every call of the mm package on the trace into one
+ *    histogram per request type. The trace is replayed LAT_REPS times
+ *    on a fresh heap, so rare slow paths (heap extension, coalescing)
+ *    show up in the tail percentiles instead of vanishing in a mean.
+ */
+static void eval_mm_lat(trace_t *trace, latstats_t *stats)
+{
+    int i, rep, index;
+    traceop_t *op;
+    char *p;
+    uint64_t t0, t1;
+
+    for (i = 0; i < 3; i++)
+	lathist_reset(&stats->hist[i]);
+
+    for (rep = 0; rep < LAT_REPS; rep++) {
+	mem_reset_brk();
+	if (mm_init() < 0)
+	    app_error("mm_init failed in eval_mm_lat");
+
+	for (i = 0; i < trace->num_ops; i++) {
+	    op = &trace->ops[i];
+	    index = op->index;
+	    switch (op->type) {
+
+	    case ALLOC: /* mm_malloc */
+		t0 = lathist_now();
+		p = mm_malloc(op->size);
+		t1 = lathist_now();
+		if (p == NULL)
+		    app_error("mm_malloc error in eval_mm_lat");
+		trace->blocks[index] = p;
+		break;
+
+	    case REALLOC: /* mm_realloc */
+		t0 = lathist_now();
+		p = mm_realloc(trace->blocks[index], op->size);
+		t1 = lathist_now();
+		if (p == NULL)
+		    app_error("mm_realloc error in eval_mm_lat");
+		trace->blocks[index] = p;
+		break;
+
+	    case FREE: /* mm_free */
+		t0 = lathist_now();
+		mm_free(trace->blocks[index]);
+		t1 = lathist_now();
+		break;
+
+	    default:
+		app_error("Nonexistent request type in eval_mm_lat");
+		return;
+	    }
+	    lathist_record(&stats->hist[op->type], t1 - t0);
+	}
+    }
+    stats->valid = 1;
+}
+
+/*
+ * eval_mm_perf - Count the hardware events of PERF_REPS speed runs of
+ *    the trace. The counters only run inside eval_mm_speed, so they
+ *    see the same work as the throughput measurement.
+ */
+static void eval_mm_perf(speed_t *speed, perfstats_t *stats)
+{
+    int rep;
+
+    for (rep = 0; rep < PERF_REPS; rep++) {
+	perfctr_start();
+	eval_mm_speed(speed);
+	perfctr_stop(stats->count);
+    }
+    stats->ops = (double)speed->trace->num_ops * PERF_REPS;
+    stats->valid = 1;
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -840,7 +1530,7 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
         switch (trace->ops[i].type) {
 
         case ALLOC: /* malloc */
-	    if ((p = malloc(trace->ops[i].size)) == NULL) {
+	    if ((p = be->malloc(trace->ops[i].size)) == NULL) {
 		malloc_error(tracenum, i, "libc malloc failed");
 		unix_error("System message");
 	    }
@@ -850,7 +1540,7 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
 	case REALLOC: /* realloc */
             newsize = trace->ops[i].size;
 	    oldp = trace->blocks[trace->ops[i].index];
-	    if ((newp = realloc(oldp, newsize)) == NULL) {
+	    if ((newp = be->realloc(oldp, newsize)) == NULL) {
 		malloc_error(tracenum, i, "libc realloc failed");
 		unix_error("System message");
 	    }
@@ -858,7 +1548,7 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
 	    break;
 	    
         case FREE: /* free */
-	    free(trace->blocks[trace->ops[i].index]);
+	    be->free(trace->blocks[trace->ops[i].index]);
 	    break;
 
 	default:
@@ -886,7 +1576,7 @@ static void eval_libc_speed(void *ptr)
         case ALLOC: /* malloc */
 	    index = trace->ops[i].index;
 	    size = trace->ops[i].size;
-	    if ((p = malloc(size)) == NULL)
+	    if ((p = be->malloc(size)) == NULL)
 		unix_error("malloc failed in eval_libc_speed");
 	    trace->blocks[index] = p;
 	    break;
@@ -895,7 +1585,7 @@ static void eval_libc_speed(void *ptr)
 	    index = trace->ops[i].index;
 	    newsize = trace->ops[i].size;
 	    oldp = trace->blocks[index];
-	    if ((newp = realloc(oldp, newsize)) == NULL)
+	    if ((newp = be->realloc(oldp, newsize)) == NULL)
 		unix_error("realloc failed in eval_libc_speed\n");
 	    
 	    trace->blocks[index] = newp;
@@ -904,7 +1594,7 @@ static void eval_libc_speed(void *ptr)
         case FREE: /* free */
 	    index = trace->ops[i].index;
 	    block = trace->blocks[index];
-	    free(block);
+	    be->free(block);
 	    break;
 	}
     }
@@ -918,7 +1608,7 @@ static void eval_libc_speed(void *ptr)
 /*
  * printresults - prints a performance summary for some malloc package
  */
-static void printresults(int n, stats_t *stats) 
+static void printresults(int n, stats_t *stats, int errors) 
 {
     int i;
     double secs = 0;
@@ -972,6 +1662,299 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * printmtresults - prints the aggregate throughput of the -j replays and
+ *     the mean latency per op of their threads (each thread with -V)
+ */
+static void printmtresults(int n, mtstats_t *stats)
+{
+    int i, k;
+    double ops = 0, secs = 0, lat, lmin, lmax, lsum;
+
+    printf("%5s%8s%10s%8s  %s\n",
+	   "trace", "ops", "secs", "Kops", "ns/op per thread (min avg max)");
+    for (i = 0; i < n; i++) {
+	if (stats[i].nthreads == 0) { /* not valid, never replayed */
+	    printf("%2d%11s%10s%8s\n", i, "-", "-", "-");
+	    continue;
+	}
+	lmin = DBL_MAX;
+	lmax = lsum = 0;
+	for (k = 0; k < stats[i].nthreads; k++) {
+	    lat = stats[i].tops[k] ? stats[i].tsecs[k] * 1e9 / stats[i].tops[k] : 0;
+	    if (lat < lmin)
+		lmin = lat;
+	    if (lat > lmax)
+		lmax = lat;
+	    lsum += lat;
+	}
+	printf("%2d%11.0f%10.6f%8.0f  %.1f %.1f %.1f\n",
+	       i,
+	       stats[i].ops,
+	       stats[i].secs,
+	       (stats[i].ops/1e3)/stats[i].secs,
+	       lmin, lsum/stats[i].nthreads, lmax);
+	if (verbose > 1)
+	    for (k = 0; k < stats[i].nthreads; k++)
+		printf("%13s%d: %8.0f ops %10.6f secs\n", "thread ",
+		       k, stats[i].tops[k], stats[i].tsecs[k]);
+	ops += stats[i].ops;
+	secs += stats[i].secs;
+    }
+    if (secs > 0)
+	printf("%-5s%8.0f%10.6f%8.0f\n", "Total", ops, secs, (ops/1e3)/secs);
+}
+
+/*
+ * keepbenchstats - Copy the statistics of the latest measurement when
+ *     timing with the benchmark runner
+ */
+static void keepbenchstats(stats_t *stats)
+{
+#if USE_BENCH
+    bench_stats_t *b = bench_last();
+
+    stats->ci95 = b->ci95;
+    stats->samples = b->samples;
+    stats->outliers = b->outliers;
+#endif
+}
+
+/*
+ * writeresults - Write the results of every trace to path, as JSON if
+ *     the name ends in ".json" and as CSV otherwise, for scripts that 
+ *     compare runs. Without USE_BENCH the ci95/samples/outliers are 0.
+ */
+static void writeresults(char *path, char **tracefiles, int n, 
+			 backend_t **backends, int nbackends, double perfindex)
+{
+    FILE *fp;
+    int i, b, len = strlen(path);
+    int json = (len >= 5 && !strcmp(path + len - 5, ".json"));
+
+    if ((fp = fopen(path, "w")) == NULL) {
+	sprintf(msg, "Could not open %s in writeresults", path);
+	unix_error(msg);
+    }
+    if (json) 
+	fprintf(fp, "{\n  \"errors\": %d,\n  \"perfindex\": %.1f,\n"
+		"  \"results\": [\n", mm_backend.errors, perfindex);
+    else
+	fprintf(fp, "package,trace,valid,util,ops,secs,secs_ci95,kops,"
+		"samples,outliers\n");
+    for (b = 0; b < nbackends; b++)
+	for (i = 0; i < n; i++)
+	    writestats(fp, json, backends[b]->name, tracefiles[i], 
+		       &backends[b]->stats[i], b == nbackends-1 && i == n-1);
+    if (json)
+	fprintf(fp, "  ]\n}\n");
+    if (fclose(fp) != 0)
+	unix_error("fclose failed in writeresults");
+}
+
+/*
+ * writestats - Write one result record (see writeresults)
+ */
+static void writestats(FILE *fp, int json, char *package, char *tracefile,
+		       stats_t *stats, int last)
+{
+    double kops = stats->valid ? (stats->ops/1e3)/stats->secs : 0;
+
+    if (json) {
+	fprintf(fp, "    {\"package\": ");
+	writejsonstr(fp, package);
+	fprintf(fp, ", \"trace\": ");
+	writejsonstr(fp, tracefile);
+	fprintf(fp, ", \"valid\": %s, \"util\": %.4f, \"ops\": %.0f, "
+		"\"secs\": %.9f, \"secs_ci95\": %.9f, \"kops\": %.1f, "
+		"\"samples\": %d, \"outliers\": %d}%s\n",
+		stats->valid ? "true" : "false", 
+		stats->util, stats->ops, stats->secs, stats->ci95, kops,
+		stats->samples, stats->outliers, last ? "" : ",");
+    }
+    else
+	fprintf(fp, "%s,%s,%d,%.4f,%.0f,%.9f,%.9f,%.1f,%d,%d\n",
+		package, tracefile, stats->valid, stats->util, stats->ops,
+		stats->secs, stats->ci95, kops, stats->samples, stats->outliers);
+}
+
+/*
+ * writejsonstr - Write str as a JSON string, with quotes, backslashes
+ *     and control characters escaped
+ */
+static void writejsonstr(FILE *fp, char *str)
+{
+    unsigned char c;
+
+    fputc('"', fp);
+    for (; (c = *str) != '\0'; str++) {
+	if (c == '"' || c == '\\')
+	    fprintf(fp, "\\%c", c);
+	else if (c < 0x20)
+	    fprintf(fp, "\\u%04x", c);
+	else
+	    fputc(c, fp);
+    }
+    fputc('"', fp);
+}
+
+/*
+ * load_backend - dlopen an allocator package. A shared object with
+ *     mm_init, mm_malloc, mm_free and mm_realloc is a heap model
+ *     package: it must get its memory from mdriver's memlib.c (link 
+ *     it without memlib.o, mdriver exports its symbols). Otherwise the
+ *     object must provide malloc, free and realloc.
+ */
+static backend_t *load_backend(char *path)
+{
+    backend_t *b;
+    void *handle;
+    char *base;
+
+    if ((handle = dlopen(path, RTLD_NOW | RTLD_LOCAL)) == NULL) {
+	sprintf(msg, "ERROR: can't load %s: %s", path, dlerror());
+	app_error(msg);
+    }
+    if ((b = (backend_t *)calloc(1, sizeof(backend_t))) == NULL)
+	unix_error("calloc failed in load_backend");
+    base = strrchr(path, '/');
+    b->name = base ? base + 1 : path;
+    b->desc = path;
+
+    if ((b->malloc = dlsym(handle, "mm_malloc")) != NULL) {
+	b->heapmodel = 1;
+	b->init = dlsym(handle, "mm_init");
+	b->free = dlsym(handle, "mm_free");
+	b->realloc = dlsym(handle, "mm_realloc");
+    }
+    else {
+	b->malloc = dlsym(handle, "malloc");
+	b->free = dlsym(handle, "free");
+	b->realloc = dlsym(handle, "realloc");
+    }
+    if (!b->malloc || !b->free || !b->realloc || (b->heapmodel && !b->init)) {
+	sprintf(msg, "ERROR: %s has neither the mm.h nor the malloc interface",
+		path);
+	app_error(msg);
+    }
+    return b;
+}
+
+/*
+ * printallresults - prints the util (heap model packages only) and the
+ *     throughput of every package on every trace side by side
+ */
+static void printallresults(int n, backend_t **backends, int nbackends)
+{
+    int i, b;
+    double ops, secs, util;
+    stats_t *st;
+
+    printf("%5s", "trace");
+    for (b = 0; b < nbackends; b++)
+	printf("%16.16s", backends[b]->name);
+    printf("\n");
+    for (i = 0; i < n; i++) {
+	printf("%2d   ", i);
+	for (b = 0; b < nbackends; b++) {
+	    st = &backends[b]->stats[i];
+	    if (!st->valid)
+		printf("%16s", "-");
+	    else if (backends[b]->heapmodel)
+		printf("%6.0f%%%9.0f", st->util*100.0, (st->ops/1e3)/st->secs);
+	    else
+		printf("%7s%9.0f", "-", (st->ops/1e3)/st->secs);
+	}
+	printf("\n");
+    }
+    printf("%-5s", "Total");
+    for (b = 0; b < nbackends; b++) {
+	ops = secs = util = 0;
+	for (i = 0; i < n; i++) {
+	    st = &backends[b]->stats[i];
+	    if (!st->valid)
+		break;
+	    ops += st->ops;
+	    secs += st->secs;
+	    util += st->util;
+	}
+	if (i < n)
+	    printf("%16s", "-");
+	else if (backends[b]->heapmodel)
+	    printf("%6.0f%%%9.0f", util/n*100.0, (ops/1e3)/secs);
+	else
+	    printf("%7s%9.0f", "-", (ops/1e3)/secs);
+    }
+    printf("\n");
+}
+
+/*
+ * printperfresults - prints the counted hardware events per op of every
+ *     trace, "-" for a counter the system doesn't provide
+ */
+static void printperfresults(int n, perfstats_t *stats)
+{
+    int i, j;
+
+    printf("%5s", "trace");
+    for (j = 0; j < PC_NUM; j++)
+	printf("%13s", perfctr_name(j));
+    printf("\n");
+    for (i = 0; i < n; i++) {
+	printf("%2d   ", i);
+	for (j = 0; j < PC_NUM; j++) {
+	    if (stats[i].valid && perfctr_avail(j))
+		printf("%13.3f", stats[i].count[j] / stats[i].ops);
+	    else
+		printf("%13s", "-");
+	}
+	printf("\n");
+    }
+}
+
+/*
+ * printlatresults - prints the latency percentiles of each request type
+ *     for each trace, and the clock overhead included in every sample
+ */
+static void printlatresults(int n, latstats_t *stats)
+{
+    static char *opname[3] = {"malloc", "free", "realloc"};
+    uint64_t t, overhead = UINT64_MAX;
+    lathist_t *h;
+    int i, j;
+
+    /* The cheapest back to back clock read */
+    for (i = 0; i < 1000; i++) {
+	t = lathist_now();
+	t = lathist_now() - t;
+	if (t < overhead)
+	    overhead = t;
+    }
+
+    printf("%5s %-8s%10s%8s%8s%8s%9s\n",
+	   "trace", "op", "calls", "p50", "p99", "p99.9", "max");
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid) {
+	    printf("%2d%4s%-8s%10s%8s%8s%8s%9s\n", i, "", "-", "-", "-", "-", "-", "-");
+	    continue;
+	}
+	for (j = 0; j < 3; j++) {
+	    h = &stats[i].hist[j];
+	    if (h->count == 0)
+		continue;
+	    printf("%2d%4s%-8s%10llu%8llu%8llu%8llu%9llu\n",
+		   i, "", opname[j],
+		   (unsigned long long)h->count,
+		   (unsigned long long)lathist_percentile(h, 50.0),
+		   (unsigned long long)lathist_percentile(h, 99.0),
+		   (unsigned long long)lathist_percentile(h, 99.9),
+		   (unsigned long long)h->max);
+	}
+    }
+    printf("(each sample includes ~%llu ns of clock overhead)\n",
+	   (unsigned long long)overhead);
+}
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -991,12 +1974,17 @@ void unix_error(char *msg)
 }
 
 /*
- * malloc_error - Report an error returned by the mm_malloc package
+ * malloc_error - Report an error returned by the package under test (be).
+ *     Only the errors of mm malloc count against the performance index
  */
 void malloc_error(int tracenum, int opnum, char *msg)
 {
-    errors++;
-    printf("ERROR [trace %d, line %d]: %s\n", tracenum, LINENUM(opnum), msg);
+    be->errors++;
+    if (be == &mm_backend)
+	printf("ERROR [trace %d, line %d]: %s\n", tracenum, LINENUM(opnum), msg);
+    else
+	printf("ERROR [%s, trace %d, line %d]: %s\n", be->name, tracenum,
+	       LINENUM(opnum), msg);
 }
 
 /* 
@@ -1004,14 +1992,25 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValkHP] [-f <file>] [-t <dir>] [-b <lib.so>] [-j <n>] [-R <n>] [-W <n>] [-C <cpu>] [-O <file>] [-T <n>[:<file>]]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-b <lib>   Run the allocator in shared object <lib> as well.\n");
+    fprintf(stderr, "\t-C <cpu>   Pin mdriver to CPU <cpu>.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H         Print latency percentiles of every mm call.\n");
+    fprintf(stderr, "\t-j <n>     Also replay each trace on <n> threads (mdriver-mt, mdriver-remote).\n");
+    fprintf(stderr, "\t-k         Keep outlier runs in the means (USE_BENCH).\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-O <file>  Write the results to <file> (.json or CSV).\n");
+    fprintf(stderr, "\t-P         Print hardware counters per op of mm malloc.\n");
+    fprintf(stderr, "\t-R <n>     Time each trace <n> times (USE_BENCH).\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T <n>     Sample the mm heap every <n> ops into timeline.csv\n");
+    fprintf(stderr, "\t           (or <file>, with -T <n>:<file>).\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
+    fprintf(stderr, "\t-W <n>     Run each trace <n> times untimed first (USE_BENCH).\n");
 }
@@ -14,19 +14,30 @@
 #include "memlib.h"
 #include "config.h"
 
+/* private functions */
+static void mem_unprotect_all(void);
+
 /* private variables */
 static char *mem_start_brk;  /* points to first byte of heap */
 static char *mem_brk;        /* points to last byte of heap */
 static char *mem_max_addr;   /* largest legal heap address */ 
+static int mem_guarded;      /* number of pages made inaccessible by mem_protect */
 
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	fprintf(stderr, "mem_init_vm: malloc error\n");
+    /* 
+     * Reserve the address space we will use to model the available
+     * VM. Pages are only backed by memory once the heap touches them,
+     * so MAX_HEAP can be much bigger than the heaps of the traces.
+     */
+    mem_start_brk = mmap(NULL, MAX_HEAP, PROT_READ|PROT_WRITE,
+			 MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+    if (mem_start_brk == MAP_FAILED) {
+	fprintf(stderr, "mem_init_vm: can't map a %lu byte heap\n",
+		(unsigned long)MAX_HEAP);
 	exit(1);
     }
 
@@ -39,7 +50,8 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    mem_unprotect_all();
+    munmap(mem_start_brk, MAX_HEAP);
 }
 
 /*
@@ -48,6 +60,7 @@ void mem_deinit(void)
 void mem_reset_brk()
 {
     mem_brk = mem_start_brk;
+    mem_unprotect_all();
 }
 
 /* 
@@ -55,11 +68,11 @@ void mem_reset_brk()
  *    by incr bytes and returns the start address of the new area. In
  *    this model, the heap cannot be shrunk.
  */
-void *mem_sbrk(int incr) 
+void *mem_sbrk(intptr_t incr) 
 {
     char *old_brk = mem_brk;
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+    if ( (incr < 0) || (incr > mem_max_addr - mem_brk)) {
 	errno = ENOMEM;
 	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 	return (void *)-1;
@@ -99,3 +112,38 @@ size_t mem_pagesize()
 {
     return (size_t)getpagesize();
 }
+
+/*
+ * mem_protect - make the pages in [addr, addr+len) inaccessible (if
+ *    noaccess) or accessible again. addr and len must be multiples of
+ *    the page size and the pages must lie within the heap. Used by the
+ *    debug build of mm.c for guard pages.
+ */
+int mem_protect(void *addr, size_t len, int noaccess)
+{
+    if ((char *)addr < mem_start_brk || (char *)addr + len > mem_brk ||
+	mprotect(addr, len, noaccess ? PROT_NONE : PROT_READ|PROT_WRITE) < 0) {
+	fprintf(stderr, "ERROR: mem_protect(%p, %lu) failed\n", 
+		addr, (unsigned long)len);
+	return -1;
+    }
+    mem_guarded += (noaccess ? 1 : -1) * (int)(len / mem_pagesize());
+    return 0;
+}
+
+/*
+ * mem_unprotect_all - make the whole heap accessible again, so that a
+ *    new run does not fault on guard pages of an old one
+ */
+static void mem_unprotect_all(void)
+{
+    size_t pagesize = mem_pagesize();
+    char *lo, *hi;
+
+    if (mem_guarded == 0)
+	return;
+    lo = (char *)(((unsigned long)mem_start_brk + pagesize - 1) & ~(pagesize - 1));
+    hi = (char *)((unsigned long)mem_max_addr & ~(pagesize - 1));
+    mprotect(lo, hi - lo, PROT_READ|PROT_WRITE);
+    mem_guarded = 0;
+}
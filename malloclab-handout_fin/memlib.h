@@ -1,11 +1,13 @@
 #include <unistd.h>
+#include <stdint.h>
 
 void mem_init(void);               
 void mem_deinit(void);
-void *mem_sbrk(int incr);
+void *mem_sbrk(intptr_t incr);
 void mem_reset_brk(void); 
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
 size_t mem_pagesize(void);
+int mem_protect(void *addr, size_t len, int noaccess);
 
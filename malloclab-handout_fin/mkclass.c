@@ -0,0 +1,220 @@
+/*
+ * mkclass.c - Generate the size class table used by mm.c
+ *
+ * Reads a declarative size class spec (see sizeclass.spec) and writes
+ * a C header on stdout with:
+ *
+ *   CNUM          the number of size classes
+ *   SC_NAME       the label of the spec
+ *   SC_DESC       a one line description reported by mdriver
+ *   class_bound[] the (inclusive) upper bound of each class in bytes
+ *   class_lut[]   class index of every block size up to SC_LUT_MAX,
+ *                 indexed by size/SC_ALIGN
+ *
+ * usage: mkclass <specfile> > sizeclass.h
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define MAXLINE   1024 /* max spec line length */
+#define MAXCLASS   255 /* class indices must fit in the unsigned char lut */
+#define MAXPINNED   64 /* max number of "bound" lines */
+
+/* The parsed spec */
+typedef struct {
+    char name[MAXLINE];
+    unsigned min;
+    unsigned base;
+    unsigned max;
+    double ratio;
+    unsigned align;
+    unsigned lut;
+    unsigned pinned[MAXPINNED];
+    int npinned;
+} spec_t;
+
+static void read_spec(char *path, spec_t *spec);
+static int make_bounds(spec_t *spec, unsigned *bound);
+static int cmp_unsigned(const void *a, const void *b);
+static void spec_error(char *path, int linenum, char *msg);
+
+int main(int argc, char **argv)
+{
+    spec_t spec;
+    unsigned bound[MAXCLASS+1];
+    unsigned size;
+    int n, i, idx;
+
+    if (argc != 2) {
+	fprintf(stderr, "usage: %s <specfile>\n", argv[0]);
+	exit(1);
+    }
+    read_spec(argv[1], &spec);
+    n = make_bounds(&spec, bound);
+
+    printf("/*\n * sizeclass.h - generated by mkclass from %s. Do not edit.\n */\n",
+	   argv[1]);
+    printf("#ifndef __SIZECLASS_H_\n#define __SIZECLASS_H_\n\n");
+    printf("#define SC_NAME \"%s\"\n", spec.name);
+    printf("#define SC_DESC \"%s: %d classes, %u..%u bytes, x%g\"\n",
+	   spec.name, n, spec.min, spec.max, spec.ratio);
+    printf("#define CNUM %d\n", n);
+    printf("#define SC_ALIGN %u\n", spec.align);
+    printf("#define SC_LUT_MAX %u\n\n", spec.lut);
+
+    /* The last class is open ended */
+    printf("static const unsigned int class_bound[CNUM] = {");
+    for (i = 0; i < n; i++)
+	printf("%s%u%s", (i % 8) ? " " : "\n    ",
+	       (i == n-1) ? 0xffffffffu : bound[i], (i == n-1) ? "" : ",");
+    printf("\n};\n\n");
+
+    /* Sizes below the minimum block size never occur, map them to class 0 */
+    printf("static const unsigned char class_lut[SC_LUT_MAX/SC_ALIGN + 1] = {");
+    idx = 0;
+    for (size = 0; size <= spec.lut; size += spec.align) {
+	while (idx < n-1 && size > bound[idx])
+	    idx++;
+	printf("%s%d%s", ((size/spec.align) % 16) ? " " : "\n    ", idx,
+	       (size + spec.align > spec.lut) ? "" : ",");
+    }
+    printf("\n};\n\n#endif /* __SIZECLASS_H_ */\n");
+    return 0;
+}
+
+/*
+ * read_spec - parse the spec file into *spec, exiting on any error
+ */
+static void read_spec(char *path, spec_t *spec)
+{
+    FILE *fp;
+    char line[MAXLINE], key[MAXLINE], val[MAXLINE];
+    int linenum = 0;
+
+    memset(spec, 0, sizeof(*spec));
+    strcpy(spec->name, "unnamed");
+    spec->ratio = 2.0;
+    spec->align = 8;
+
+    if ((fp = fopen(path, "r")) == NULL) {
+	perror(path);
+	exit(1);
+    }
+    while (fgets(line, MAXLINE, fp) != NULL) {
+	linenum++;
+	if (sscanf(line, "%s", key) != 1 || key[0] == '#')
+	    continue;
+	if (sscanf(line, "%s %s", key, val) != 2)
+	    spec_error(path, linenum, "missing value");
+
+	if (!strcmp(key, "name"))
+	    strcpy(spec->name, val);
+	else if (!strcmp(key, "min"))
+	    spec->min = strtoul(val, NULL, 0);
+	else if (!strcmp(key, "base"))
+	    spec->base = strtoul(val, NULL, 0);
+	else if (!strcmp(key, "max"))
+	    spec->max = strtoul(val, NULL, 0);
+	else if (!strcmp(key, "ratio"))
+	    spec->ratio = atof(val);
+	else if (!strcmp(key, "align"))
+	    spec->align = strtoul(val, NULL, 0);
+	else if (!strcmp(key, "lut"))
+	    spec->lut = strtoul(val, NULL, 0);
+	else if (!strcmp(key, "bound")) {
+	    if (spec->npinned == MAXPINNED)
+		spec_error(path, linenum, "too many bound lines");
+	    spec->pinned[spec->npinned++] = strtoul(val, NULL, 0);
+	}
+	else
+	    spec_error(path, linenum, "unknown key");
+    }
+    fclose(fp);
+
+    if (spec->align == 0 || (spec->align & (spec->align-1)))
+	spec_error(path, 0, "align must be a power of two");
+    if (spec->min == 0 || spec->min % spec->align)
+	spec_error(path, 0, "min must be a positive multiple of align");
+    if (spec->base == 0)
+	spec->base = spec->min;
+    if (spec->base < spec->min || spec->base % spec->align)
+	spec_error(path, 0, "base must be a multiple of align, at least min");
+    if (spec->max < spec->base)
+	spec_error(path, 0, "max must not be smaller than base");
+    if (spec->ratio <= 1.0)
+	spec_error(path, 0, "ratio must be greater than 1");
+    if (spec->lut % spec->align)
+	spec_error(path, 0, "lut must be a multiple of align");
+}
+
+/*
+ * make_bounds - compute the class upper bounds into bound[] and return
+ *     the number of classes (including the final open ended class)
+ */
+static int make_bounds(spec_t *spec, unsigned *bound)
+{
+    double next;
+    unsigned b;
+    int n = 0, i, j;
+
+    /* Geometric boundaries from base, each at least one alignment step apart */
+    if (spec->min < spec->base)
+	bound[n++] = spec->min;
+    b = spec->base;
+    while (1) {
+	if (n == MAXCLASS) {
+	    fprintf(stderr, "mkclass: more than %d classes\n", MAXCLASS);
+	    exit(1);
+	}
+	bound[n++] = b;
+	if (b >= spec->max)
+	    break;
+	next = ceil(b * spec->ratio / spec->align) * spec->align;
+	b = (next > b + spec->align) ? (unsigned)next : b + spec->align;
+	if (b > spec->max)
+	    b = spec->max;
+    }
+
+    /* Merge in the pinned boundaries, dropping duplicates */
+    for (i = 0; i < spec->npinned; i++) {
+	if (spec->pinned[i] % spec->align || spec->pinned[i] < spec->min
+	    || spec->pinned[i] > spec->max) {
+	    fprintf(stderr, "mkclass: bad bound %u\n", spec->pinned[i]);
+	    exit(1);
+	}
+	if (n == MAXCLASS) {
+	    fprintf(stderr, "mkclass: more than %d classes\n", MAXCLASS);
+	    exit(1);
+	}
+	bound[n++] = spec->pinned[i];
+    }
+    qsort(bound, n, sizeof(unsigned), cmp_unsigned);
+    for (i = 1, j = 1; i < n; i++)
+	if (bound[i] != bound[j-1])
+	    bound[j++] = bound[i];
+    n = j;
+
+    /* Everything above max goes to one last open ended class */
+    bound[n++] = 0xffffffffu;
+    return n;
+}
+
+static int cmp_unsigned(const void *a, const void *b)
+{
+    unsigned x = *(const unsigned *)a, y = *(const unsigned *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * spec_error - report a malformed spec and exit
+ */
+static void spec_error(char *path, int linenum, char *msg)
+{
+    if (linenum)
+	fprintf(stderr, "%s:%d: %s\n", path, linenum, msg);
+    else
+	fprintf(stderr, "%s: %s\n", path, msg);
+    exit(1);
+}
@@ -10,13 +10,17 @@
  *
  * In this seggregated free list approach, each free list has class of size.
  * Since the minimum essential free block size is 24Bytes( = header(4B) + footer(4B) + next_ptr(8B) + prev_ptr(8B) ),
- * first free list has size class (only 24B). And other i-th free list has size class (2^(i+2)+1 Bytes to 2^(i+3) Bytes).
- * For example, 9th free list has size class (2049Bytes to 4096Bytes). We have 17 size classes.
+ * first free list has size class (only 24B). The other class boundaries are not written here, they are generated
+ * at build time by mkclass from sizeclass.spec into sizeclass.h (CNUM classes, class_bound[] and class_lut[]).
+ * i-th free list has size class (class_bound[i-1]+1 Bytes to class_bound[i] Bytes) and the last class takes every bigger block.
+ * The default spec keeps power of two classes (2^(i+3) Bytes upper bound for i >= 1, 17 classes), geo125.spec spaces them by 1.25x.
  *
  * Every newly generated free block inserted to head of corresponing size class free list. For example, newly freed block has size
- * 4080 Bytes, this block will be inserted to head of list[8].
+ * 4080 Bytes, this block will be inserted to head of list[class_idx(4080)].
  * Also, every finding free block for allocation, searching the block from corresponding size class free list. First-fit policy is choosen.
  * If there's no available free block in that free list, searching the block from the next size class free list(bigger size class).
+ * Each size class also keeps an upper bound of the block sizes in its list(CMAX), raised in add_list and lowered to the exact
+ * maximum whenever a search walks the whole list without a fit, so a long list that cannot fit the request is skipped without walking it.
  * At the end, there's no fit free block, extend heap size and allocate to extended heap area.
  * 
  * In coalescing and placing, it may need to remove free block from free list and add newly generated free block to free list.
@@ -25,6 +29,35 @@
  * In removing, we have to consider 4 cases. More detail, in source code.
  * 
  * There's some macros for manipulating the free lists. More detail, in source code.
+ *
+ * Payloads are 8 bytes aligned. Built with -DALIGNMENT=16 every block size is a multiple of 16 and the list area in
+ * front of the prologue is padded(LISTSIZE), so payloads are 16 bytes aligned, and the smallest block grows to 32 bytes.
+ *
+ * Remote free (build with -DMM_REMOTE_FREE) : the heap is one arena owned by the thread which called mm_init.
+ * mm_free called from any other thread does not touch the free lists, it only pushes the block to a lock-free
+ * MPSC stack('remote_list') with a single CAS. The owner thread takes the whole stack with one atomic exchange
+ * and frees those blocks in a batch at its next mm_malloc/mm_free, so the owner's fast path never takes a lock.
+ * Only the owner may call mm_malloc and mm_realloc.
+ *
+ * Thread-safe build (build with -DMM_THREADSAFE, 'make mdriver-mt') : any thread may call every function. mm_malloc
+ * and mm_realloc take one heap mutex('heap_lock'). mm_free only tries it, when the heap is busy the block is pushed to
+ * the same remote stack as above instead of waiting, and the next thread holding the lock drains the stack.
+ * MM_REMOTE_FREE and MM_THREADSAFE can't be combined.
+ *
+ * mm_heapstats reports the number of free blocks, their total size and the largest one, mdriver -T samples it
+ * during a trace to draw a fragmentation timeline.
+ *
+ * Event tracing (build with -DMM_TRACE) : every mm_malloc/mm_free/mm_realloc is recorded with its size, address
+ * and timestamp by mmtrace.c into a lock-free ring buffer, which is flushed to the binary file named by the
+ * MM_TRACE_FILE environment variable. trace2rep converts such a file to a .rep trace for mdriver.
+ *
+ * Debug mode (build with -DMM_DEBUG, 'make mdriver-debug') : every payload is surrounded by canaries. In front of it
+ * there's a 16 bytes debug header(requested size, offset from the block pointer, canary) and right after it a trailing
+ * canary. Payloads of GUARD_MIN bytes or more instead end exactly at a PROT_NONE guard page inside their block
+ * (made by mem_protect in memlib.c), so an overflow faults at the faulting instruction. The canaries and the block's
+ * header are validated on every free, a corrupted block or a double free aborts with a message. A block pushed to
+ * the remote stack is validated before the push(RELEASE), since the push overwrites the start of its payload. In the
+ * normal build none of this code exists.
  * For other detailed description of functions, please read header comment of each functions.
  */
 #include <stdio.h>
@@ -32,9 +65,54 @@
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
+#include <limits.h>
 
 #include "mm.h"
 #include "memlib.h"
+#ifndef SC_DESC /* unless the header of another spec was forced in(see the mm-so rule of the Makefile) */
+#include "sizeclass.h"
+#endif
+
+#if defined(MM_REMOTE_FREE) && defined(MM_THREADSAFE)
+#error "MM_REMOTE_FREE and MM_THREADSAFE can't be combined"
+#endif
+
+#if defined(MM_REMOTE_FREE) || defined(MM_THREADSAFE)
+#include <pthread.h>
+#define REMOTE_STACK
+#endif
+
+#ifdef MM_THREADSAFE
+#define LOCK() pthread_mutex_lock(&heap_lock)
+#define UNLOCK() pthread_mutex_unlock(&heap_lock)
+#else
+#define LOCK()
+#define UNLOCK()
+#endif
+
+#ifdef MM_DEBUG
+#include <stdint.h>
+#endif
+
+#ifdef MM_TRACE
+#include "mmtrace.h"
+#define TRACE_EVENT(op,addr,oldaddr,size) mmtrace_event((op),(addr),(oldaddr),(size))
+#else
+#define TRACE_EVENT(op,addr,oldaddr,size)
+#endif
+
+/* The block operations behind the public functions (with or without the debug layer) */
+#ifdef MM_DEBUG
+#define ALLOC(size) debug_malloc(size)
+#define FREE(ptr) debug_free(ptr)
+#define REALLOC(ptr,size) debug_realloc((ptr),(size))
+#define RELEASE(ptr) debug_release(ptr)
+#else
+#define ALLOC(size) alloc_block(size)
+#define FREE(ptr) free_block(ptr)
+#define REALLOC(ptr,size) realloc_block((ptr),(size))
+#define RELEASE(ptr) (ptr)
+#endif
 
 /*********************************************************
  * NOTE TO STUDENTS: Before you do anything else, please
@@ -53,11 +131,16 @@ team_t team = {
     ""
 };
 
-/* single word (4) or double word (8) alignment */
+/* Description of the size class table compiled in (reported by mdriver) */
+const char *mm_sizeclass = SC_DESC;
+
+/* double word (8) or quad word (16) alignment, build with -DALIGNMENT=16 for the latter (and see config.h) */
+#ifndef ALIGNMENT
 #define ALIGNMENT 8
+#endif
 
 /* rounds up to the nearest multiple of ALIGNMENT */
-#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~0x7)
+#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~(ALIGNMENT-1))
 
 
 #define SIZE_T_SIZE (ALIGN(sizeof(size_t)))
@@ -67,6 +150,17 @@ team_t team = {
 #define CHUNKSIZE (1<<12) /*Extend heap by this amount (bytes)*/
 
 #define MAX(x,y) ((x) > (y) ? (x) : (y))
+#define MIN(x,y) ((x) < (y) ? (x) : (y))
+
+/* Smallest block : header(4B) + next_ptr(8B) + prev_ptr(8B) + footer(4B), so it can be freed (32 Bytes with 16 alignment) */
+#define MINBLOCK ALIGN(3*DSIZE)
+
+/* Block size for size bytes of payload : payload plus header and footer, aligned, at least MINBLOCK */
+#define ASIZE(size) MAX(MINBLOCK, ALIGN((size) + DSIZE))
+
+/* Largest block a header word can describe, and the largest payload that gets one. Bigger requests fail */
+#define MAX_BLOCK ((size_t)UINT_MAX & ~(size_t)(ALIGNMENT-1))
+#define MAX_PAYLOAD (MAX_BLOCK - DSIZE - ALIGNMENT)
 
 /*Pack a size and allocated bit into a word*/
 #define PACK(size, alloc) ((size)|(alloc))
@@ -97,10 +191,17 @@ team_t team = {
 #define PUT_PPTR(bp,pp) (PPTR(bp) = (pp)) // Link PREV POINTER of pp to block bp
 
 /* FOR SEGGREGATED FREE LIST */
-#define CNUM 17 /*Number of size classes*/
+/* CNUM (number of size classes) comes from the generated sizeclass.h */
 #define CPTR(bp) *(char **)(bp)// GET head of doubly linked list with base pointer bp : C(LASS)P(OIN)T(E)R
 #define PUT_CPTR(bp,hp) (*(char **)(bp) = (hp)) // PUT hp(head pointer) to doubly linked list with base pointer bp
 
+/* Upper bound of the block sizes in size class list idx, stored in the heap right after the list base pointers */
+#define HINTSIZE (DSIZE * ((CNUM*WSIZE + (DSIZE-1)) / DSIZE)) // bytes for CNUM bounds, kept a multiple of DSIZE
+#define CMAX(idx) (*(unsigned int *)((char *)list + CNUM*DSIZE + (idx)*WSIZE))
+
+/* Bytes in front of the prologue padding : list base pointers and CMAX, padded so that every payload is ALIGNMENT aligned */
+#define LISTSIZE ALIGN(CNUM*DSIZE + HINTSIZE)
+
 /*
 
 Structure of initial heap
@@ -117,7 +218,11 @@ Structure of initial heap
 +----------------+
 +		0		 + <- padding
 +----------------+
-+	  list16	 + <- list + 16*DSIZE : base pointer of list16
++				 +
++   CMAX(0..)	 + <- list + CNUM*DSIZE : size bound of each list (HINTSIZE bytes)
++				 +
++----------------+
++   list(CNUM-1) + <- list + (CNUM-1)*DSIZE : base pointer of last list
 +----------------+ 
 +				 +
 +  more blocks   + <- list + idx * DSIZE : base pointer of list idx
@@ -197,6 +302,11 @@ static void *find_fit(size_t asize);
 static void place(void *bp, size_t asize);
 static void add_list(void *bp);
 static void remove_list(void *bp);
+static void *alloc_block(size_t size);
+static void free_block(void *bp);
+#ifndef MM_DEBUG
+static void *realloc_block(void *ptr, size_t size);
+#endif
 
 static int mm_check(void);
 static int isListed(void *bp);
@@ -205,6 +315,39 @@ static int isValid(void *bp);
 static void *heap_listp;
 static void *list;
 
+#ifdef MM_DEBUG
+#define CANARY 0xcafebabe /* canary word in front of and right after every payload */
+#define SLACK_BYTE 0xcb /* fills the gap between a guarded payload and its guard page */
+#define DBG_HDR (2*DSIZE) /* debug header in front of the payload */
+#define GUARD_MIN (1<<14) /* payloads of at least 16KB end at a guard page */
+
+/* Given the payload pointer p(returned to the user), get the fields of its debug header */
+#define DBG_SIZE(p) (*(unsigned int *)((char *)(p) - 4*WSIZE)) // requested size
+#define DBG_OFFSET(p) (*(unsigned int *)((char *)(p) - 3*WSIZE)) // p - block pointer
+#define DBG_GUARD(p) (*(unsigned int *)((char *)(p) - 2*WSIZE)) // 1 if p ends at a guard page
+#define DBG_CANARY(p) (*(unsigned int *)((char *)(p) - WSIZE)) // front canary
+
+static void *debug_malloc(size_t size);
+static void debug_free(void *p);
+static void *debug_release(void *p);
+static void *debug_realloc(void *p, size_t size);
+static void *debug_check(void *p, const char *caller);
+static void debug_error(void *p, const char *caller, const char *msg);
+#endif
+
+#ifdef MM_REMOTE_FREE
+static pthread_t owner; // thread which owns the heap (called mm_init)
+#endif
+#ifdef MM_THREADSAFE
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER; // protects the whole heap
+#endif
+#ifdef REMOTE_STACK
+static void *volatile remote_list; // head of the remote free stack, linked through NPTR
+
+static void remote_push(void *bp);
+static void remote_drain(void);
+#endif
+
 /*
  * BPTR - return the base pointer(address) of given size class(represented by index) list
  */
@@ -215,30 +358,23 @@ static void *BPTR(int idx)
 
 /*
  * class_idx - return the size class(index) from asize
+ *		Small sizes are mapped with the generated lookup table, bigger sizes with binary search on the class boundaries.
  */
 static int class_idx(unsigned int asize)
 {
-	int idx = -1;
-
-	if(asize==24) idx = 0;
-	else if(asize<=32) idx = 1;
-	else if(asize<=64) idx = 2;
-	else if(asize<=128) idx = 3;
-	else if(asize<=256) idx = 4;
-	else if(asize<=512) idx = 5;
-	else if(asize<=1024) idx = 6;
-	else if(asize<=2048) idx = 7;
-	else if(asize<=4096) idx = 8;
-	else if(asize<=8192) idx = 9;
-	else if(asize<=16384) idx = 10;
-	else if(asize<=32768) idx = 11;
-	else if(asize<=65536) idx = 12;
-	else if(asize<=131072) idx = 13;
-	else if(asize<=262144) idx = 14;
-	else if(asize<=524288) idx = 15;
-	else idx = 16;
-	
-	return idx;
+	int lo, hi, mid;
+
+	if(asize<=SC_LUT_MAX) return class_lut[asize/SC_ALIGN];
+
+	/* find the first class whose upper bound is not smaller than asize (the last bound is UINT_MAX) */
+	lo = class_lut[SC_LUT_MAX/SC_ALIGN];
+	hi = CNUM-1;
+	while(lo<hi){
+		mid = (lo+hi)/2;
+		if(class_bound[mid]<asize) lo = mid+1;
+		else hi = mid;
+	}
+	return lo;
 }
 
 /* 
@@ -251,16 +387,17 @@ int mm_init(void)
 	int i;
 
 	/* create the initial empty heap */
-	if ((list = mem_sbrk((CNUM+2)*DSIZE)) == (void *)-1)
+	if ((list = mem_sbrk(LISTSIZE + 2*DSIZE)) == (void *)-1)
 		return -1;
 	
 	/* set each size class list's head to NULL (create the initial empty size class lists) */
 	for(i=0;i<CNUM;i++){
 		base = BPTR(i);
 		PUT_CPTR(base,NULL);
+		CMAX(i) = 0;
 	}
 	
-	heap_listp = list + CNUM*DSIZE;
+	heap_listp = list + LISTSIZE;
 
 	PUT(heap_listp, 0); /*Alignment padding*/
 	PUT(heap_listp + (1*WSIZE), PACK(DSIZE,1));/*Prologue header*/
@@ -273,10 +410,16 @@ int mm_init(void)
 	if((ptr = extend_heap(CHUNKSIZE/WSIZE)) == NULL)
 		return -1;
 	
-	base = BPTR(8); // size class 8 contains free block with size 4096
-	PUT_CPTR(base,ptr); // set the initial free block
-	PUT_NPTR(CPTR(base),NULL); // set the initial free block's NEXT to NULL
-	PUT_PPTR(CPTR(base),NULL); // set the initial free block's PREV to NULL
+	add_list(ptr); // set the initial free block as the only element of its size class list
+
+#ifdef REMOTE_STACK
+	/* the heap is empty again, blocks still waiting in the remote stack are gone with it */
+	remote_list = NULL;
+#endif
+#ifdef MM_REMOTE_FREE
+	owner = pthread_self();
+#endif
+	TRACE_EVENT(MMT_INIT, NULL, NULL, 0); // mark the start of a new run in the event trace
 
 	return 0;
 }
@@ -310,20 +453,34 @@ static void *extend_heap(size_t words)
  *     Always allocate a block whose size is a multiple of the alignment.
  */
 void *mm_malloc(size_t size)
+{
+	void *bp;
+
+	LOCK();
+#ifdef REMOTE_STACK
+	remote_drain(); // blocks freed by other threads may satisfy this request
+#endif
+	bp = ALLOC(size);
+	TRACE_EVENT(MMT_MALLOC, bp, NULL, size); // under the lock, so events are logged in heap order
+	UNLOCK();
+	return bp;
+}
+
+/*
+ * alloc_block - find(or make) a free block for size bytes of payload and allocate it.
+ */
+static void *alloc_block(size_t size)
 {
 	size_t asize; /*Adjusted block size*/
 	size_t extendsize; /*Amount to extend heap if no fit*/
 	char *bp;
 	
-	/*Ignore spurious request*/
-	if(size == 0)
+	/*Ignore spurious request, and one whose size wouldn't fit in the header*/
+	if(size == 0 || size > MAX_PAYLOAD)
 		return NULL;
 
 	/*Adjust block size to include overhead and alignment reqs*/
-	if(size <= DSIZE)
-		asize = 2*DSIZE;
-	else
-		asize = DSIZE * ((size + DSIZE + (DSIZE-1)) / DSIZE);
+	asize = ASIZE(size);
 
 	/*Search the free list for a fit*/
 	if((bp = find_fit(asize)) != NULL){
@@ -353,14 +510,25 @@ static void *find_fit(size_t asize)
 	
 	void *bp;
 	void *base;
+	unsigned int size;
+	unsigned int maxsize;
 	int i = class_idx(asize); // i is index of size class which determined by asize.
 	
 	/* For searching free blocks, if there's no fit free block, searching free block in larger size class list */
 	while(i<CNUM){
+		/* skip the list without walking it if no block in it can be big enough */
+		if(CMAX(i)<asize){
+			i++;
+			continue;
+		}
 		base = BPTR(i);
+		maxsize = 0;
 		for(bp = CPTR(base); bp!=NULL; bp = NPTR(bp)){
-			if(GET_SIZE(HDRP(bp))>=asize) return bp;
+			size = GET_SIZE(HDRP(bp));
+			if(size>=asize) return bp;
+			maxsize = MAX(maxsize,size);
 		}
+		CMAX(i) = maxsize; // walked the whole list, so now the bound is exact
 		i++;
 	}
 
@@ -454,6 +622,8 @@ static void add_list(void *bp)
 	int i = class_idx(size);
 	void *base = BPTR(i);
 
+	if(size > CMAX(i)) CMAX(i) = size; // keep CMAX(i) an upper bound of the list
+
 	if(CPTR(base) == NULL){
 	/* CASE1 : size class i list is empty, set the head to bp */
 		PUT_NPTR(bp, NULL);
@@ -470,22 +640,84 @@ static void add_list(void *bp)
 }
 
 /*
- * mm_free - Freeing a block does nothing.
+ * mm_free - Free the block, coalesce it and add it to its size class list.
+ *		With MM_REMOTE_FREE, a block freed by a thread other than the owner is only pushed to the remote stack.
+ *		With MM_THREADSAFE, a block freed while another thread holds the heap lock is pushed there as well.
  */
 void mm_free(void *ptr)
 {
-	size_t size = GET_SIZE(HDRP(ptr));
+	if(ptr == NULL) return;
+	TRACE_EVENT(MMT_FREE, ptr, NULL, 0); // before the block can be reused by anyone
+#ifdef MM_REMOTE_FREE
+	if(!pthread_equal(pthread_self(), owner)){
+		remote_push(RELEASE(ptr));
+		return;
+	}
+#endif
+#ifdef MM_THREADSAFE
+	if(pthread_mutex_trylock(&heap_lock) != 0){
+		remote_push(RELEASE(ptr)); // never wait for the lock just to free
+		return;
+	}
+#endif
+#ifdef REMOTE_STACK
+	remote_drain();
+#endif
+	FREE(ptr);
+	UNLOCK();
+}
+
+/*
+ * free_block - mark the block(bp) as free, coalesce it and add it to its size class list.
+ */
+static void free_block(void *bp)
+{
+	size_t size = GET_SIZE(HDRP(bp));
 		
-	PUT(HDRP(ptr), PACK(size,0));
-	PUT(FTRP(ptr), PACK(size,0));
+	PUT(HDRP(bp), PACK(size,0));
+	PUT(FTRP(bp), PACK(size,0));
 	
-	PUT_NPTR(ptr,NULL);
-	PUT_PPTR(ptr,NULL);
+	PUT_NPTR(bp,NULL);
+	PUT_PPTR(bp,NULL);
 
-	add_list(coalesce(ptr));
+	add_list(coalesce(bp));
 
 }
 
+#ifdef REMOTE_STACK
+/*
+ * remote_push - push the block(bp) freed by a foreign thread to the remote stack with a single CAS.
+ *		bp is a block pointer(RELEASE of the payload), which is the payload itself unless MM_DEBUG.
+ *		The block stays marked as allocated until the owner drains the stack, so no other heap data is touched.
+ */
+static void remote_push(void *bp)
+{
+	void *head;
+
+	do{
+		head = remote_list;
+		PUT_NPTR(bp,head);
+	}while(!__sync_bool_compare_and_swap(&remote_list, head, bp));
+}
+
+/*
+ * remote_drain - called only by the owner(or the holder of the heap lock). Detach the whole remote stack with one atomic exchange and free its blocks.
+ *		Since the consumer always takes the entire stack, pushes never race with a pop of a single element (no ABA problem).
+ */
+static void remote_drain(void)
+{
+	void *bp;
+	void *next;
+
+	if(remote_list == NULL) return; // the common case costs one load
+
+	for(bp = __sync_lock_test_and_set(&remote_list, NULL); bp != NULL; bp = next){
+		next = NPTR(bp);
+		free_block(bp);
+	}
+}
+#endif
+
 /*
  * coalesce - coalesce the given free block(bp) to adjacent free blocks.
  */
@@ -495,6 +727,12 @@ static void *coalesce(void *bp)
 	size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp)));
 	size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
 	size_t size = GET_SIZE(HDRP(bp));
+
+	/* the merged block must still fit in a header, otherwise the neighbour stays a block of its own */
+	if(!next_alloc && size + GET_SIZE(HDRP(NEXT_BLKP(bp))) > MAX_BLOCK)
+		next_alloc = 1;
+	if(!prev_alloc && size + (next_alloc ? 0 : GET_SIZE(HDRP(NEXT_BLKP(bp)))) + GET_SIZE(HDRP(PREV_BLKP(bp))) > MAX_BLOCK)
+		prev_alloc = 1;
 	
 	if(prev_alloc && next_alloc){
 	/* CASE1 : both blocks are allocated */
@@ -537,9 +775,27 @@ static void *coalesce(void *bp)
 }
 
 /*
- * mm_realloc - Implemented simply in terms of mm_malloc and mm_free
+ * mm_realloc - Resize the block in place when possible, otherwise move it.
  */
 void *mm_realloc(void *ptr, size_t size)
+{
+	void *newptr;
+
+	LOCK();
+#ifdef REMOTE_STACK
+	remote_drain();
+#endif
+	newptr = REALLOC(ptr, size);
+	TRACE_EVENT(MMT_REALLOC, newptr, ptr, size);
+	UNLOCK();
+	return newptr;
+}
+
+#ifndef MM_DEBUG
+/*
+ * realloc_block - Implemented simply in terms of alloc_block and free_block
+ */
+static void *realloc_block(void *ptr, size_t size)
 {
 	void *newptr;
 	void *newfreeptr;
@@ -548,15 +804,15 @@ void *mm_realloc(void *ptr, size_t size)
 	size_t restsize;
 	size_t newfreesize;
 
-	if(size == 0) mm_free(ptr);
-	if(ptr == NULL) return mm_malloc(size);
+	if(ptr == NULL) return alloc_block(size);
+	if(size == 0){
+		free_block(ptr);
+		return NULL;
+	}
 	else{	
+		if(size > MAX_PAYLOAD) return NULL; // too big for a header, the old block stays
 		/*Adjust block size to include overhead and alignment reqs*/
-		
-		if(size <= DSIZE)
-			size = 2*DSIZE;
-		else
-			size = DSIZE * ((size + DSIZE + (DSIZE-1)) / DSIZE);
+		size = ASIZE(size);
 
 		oldsize = GET_SIZE(HDRP(ptr));
 
@@ -566,15 +822,16 @@ void *mm_realloc(void *ptr, size_t size)
 			
 			if(GET_SIZE(FTRP(ptr)+WSIZE) == 0){
 			/* ptr is last block (check whether next blokc is epilogue block or not)*/
-				extend_heap(restsize/WSIZE); // extend heap with restsize and merge with original block
+				if(extend_heap(restsize/WSIZE) == NULL) // extend heap with restsize and merge with original block
+					return NULL;
 				PUT(HDRP(ptr),PACK(oldsize + restsize,1));
 				PUT(FTRP(ptr),PACK(oldsize + restsize,1));
 			}
 			else{
-			/* otherwise, set new pointer use mm_malloc(size) and copy the content use memcpy and free original pointer */
-				newptr = mm_malloc(size);
+			/* otherwise, set new pointer use alloc_block(size) and copy the content use memcpy and free original pointer */
+				newptr = alloc_block(size);
 				memcpy(newptr,ptr,oldsize);
-				mm_free(ptr);
+				free_block(ptr);
 				return newptr;
 			}
 		}
@@ -599,6 +856,158 @@ void *mm_realloc(void *ptr, size_t size)
 		return ptr;
 	}
 }
+#endif
+
+/*
+ * mm_heapstats - Count the free blocks, their total size and the largest one by walking every free list.
+ *		Blocks pushed to the remote stack and not drained yet are not counted.
+ */
+void mm_heapstats(mm_heapstats_t *hs)
+{
+	int i;
+	void *bp;
+	size_t size;
+
+	hs->free_blocks = hs->free_bytes = hs->largest_free = 0;
+	LOCK();
+	for(i=0;i<CNUM;i++){
+		for(bp = CPTR(BPTR(i)); bp != NULL; bp = NPTR(bp)){
+			size = GET_SIZE(HDRP(bp));
+			hs->free_blocks++;
+			hs->free_bytes += size;
+			if(size > hs->largest_free) hs->largest_free = size;
+		}
+	}
+	UNLOCK();
+}
+
+#ifdef MM_DEBUG
+/*
+ * debug_malloc - allocate a block with room for the debug header and canaries around the payload.
+ *		A big payload is placed so that it ends right before a page inside the block, and that page is made PROT_NONE.
+ */
+static void *debug_malloc(size_t size)
+{
+	char *bp;
+	char *p;
+	char *guard;
+	size_t pagesize = mem_pagesize();
+	unsigned int canary = CANARY;
+	size_t asize = ALIGN(size);
+
+	if(size == 0 || size > MAX_PAYLOAD - DBG_HDR - 2*pagesize) return NULL; // the block must fit in a header too
+
+	if(size < GUARD_MIN){
+	/* CASE1 : [debug header][payload][trailing canary] */
+		if((bp = alloc_block(DBG_HDR + size + WSIZE)) == NULL) return NULL;
+		p = bp + DBG_HDR;
+		DBG_GUARD(p) = 0;
+		memcpy(p + size, &canary, WSIZE); // p + size is not aligned
+	}
+	else{
+	/* CASE2 : [debug header][payload][slack][guard page] ... footer, the guard page is the first whole page after the payload */
+		if((bp = alloc_block(DBG_HDR + asize + 2*pagesize)) == NULL) return NULL;
+		guard = (char *)(((uintptr_t)bp + DBG_HDR + asize + pagesize - 1) & ~(uintptr_t)(pagesize - 1));
+		p = guard - asize;
+		memset(p + size, SLACK_BYTE, asize - size);
+		DBG_GUARD(p) = 1;
+		mem_protect(guard, pagesize, 1);
+	}
+	DBG_SIZE(p) = size;
+	DBG_OFFSET(p) = p - bp;
+	DBG_CANARY(p) = CANARY;
+	return p;
+}
+
+/*
+ * debug_free - validate the block, remove its guard page and free it.
+ */
+static void debug_free(void *p)
+{
+	if(p == NULL) return;
+
+	free_block(debug_release(p));
+}
+
+/*
+ * debug_release - validate the block of payload p and remove its guard page. Return its block pointer, ready for free_block.
+ */
+static void *debug_release(void *p)
+{
+	char *bp;
+
+	bp = debug_check(p, "mm_free");
+	if(DBG_GUARD(p))
+		mem_protect((char *)p + ALIGN(DBG_SIZE(p)), mem_pagesize(), 0);
+	DBG_CANARY(p) = 0; // a second free of p fails the canary check
+	return bp;
+}
+
+/*
+ * debug_realloc - always move the block, so that every realloc validates the old block and rebuilds the canaries.
+ */
+static void *debug_realloc(void *p, size_t size)
+{
+	void *newp;
+
+	if(p == NULL) return debug_malloc(size);
+	if(size == 0){
+		debug_free(p);
+		return NULL;
+	}
+	debug_check(p, "mm_realloc");
+	if((newp = debug_malloc(size)) == NULL) return NULL;
+	memcpy(newp, p, MIN(size, DBG_SIZE(p)));
+	debug_free(p);
+	return newp;
+}
+
+/*
+ * debug_check - validate the canaries, the block header/footer of payload p and return its block pointer.
+ */
+static void *debug_check(void *p, const char *caller)
+{
+	char *bp;
+	char *q;
+	unsigned int size;
+	unsigned int canary;
+
+	if(!isValid(p) || (uintptr_t)p % ALIGNMENT)
+		debug_error(p, caller, "pointer is not a payload in the heap");
+	if(DBG_CANARY(p) != CANARY)
+		debug_error(p, caller, "front canary overwritten (underflow or double free)");
+
+	size = DBG_SIZE(p);
+	if(DBG_OFFSET(p) < DBG_HDR || DBG_OFFSET(p) % DSIZE || DBG_GUARD(p) > 1)
+		debug_error(p, caller, "debug header corrupted");
+	bp = (char *)p - DBG_OFFSET(p);
+	if(!GET_ALLOC(HDRP(bp)) || GET(HDRP(bp)) != GET(FTRP(bp)))
+		debug_error(p, caller, "block header/footer corrupted or block not allocated");
+	if(DBG_OFFSET(p) + size > GET_SIZE(HDRP(bp)) - DSIZE)
+		debug_error(p, caller, "debug header size larger than the block");
+
+	if(DBG_GUARD(p)){
+		for(q = (char *)p + size; q < (char *)p + ALIGN(size); q++)
+			if(*(unsigned char *)q != SLACK_BYTE)
+				debug_error(p, caller, "overflow into the slack before the guard page");
+	}
+	else{
+		memcpy(&canary, (char *)p + size, WSIZE);
+		if(canary != CANARY)
+			debug_error(p, caller, "trailing canary overwritten (overflow)");
+	}
+	return bp;
+}
+
+/*
+ * debug_error - report heap corruption found at payload p and abort
+ */
+static void debug_error(void *p, const char *caller, const char *msg)
+{
+	fprintf(stderr, "%s(%p) : %s\n", caller, p, msg);
+	abort();
+}
+#endif
 
 /*
 * mm_check - Heap Consistency Checker use raise function with SIGINT and SIGTRAP to 
@@ -617,19 +1026,19 @@ static int mm_check(void)
 			
 			/* Is every block in the free list marked as free? */
 			if(GET_ALLOC(HDRP(list_iter))){
-				printf("mm_check : block 0x%x is free list but not marked as free\n",(unsigned int)list_iter);
+				printf("mm_check : block %p is free list but not marked as free\n",list_iter);
 				return 0;
 			}
 
 			/* Do the pointers in the listed free block point to vaild heap address? */
 			if(!isValid(NPTR(list_iter)) || !isValid(PPTR(list_iter))){
-				printf("mm_check : block 0x%x is points invalid heap address where PPTR : 0x%x and NPTR : 0x%x\n",(unsigned int)list_iter,(unsigned int)PPTR(list_iter),(unsigned int)NPTR(list_iter));
+				printf("mm_check : block %p is points invalid heap address where PPTR : %p and NPTR : %p\n",list_iter,(void *)PPTR(list_iter),(void *)NPTR(list_iter));
 				return 0;
 			}
 			
 			/* Do the pointers in the listed free block point to vaild free blocks? */
 			if(GET_ALLOC(HDRP(NPTR(list_iter))) || GET_ALLOC(HDRP(PPTR(list_iter)))){
-				printf("mm_check : block 0x%x is points invalid free blocks where PPTR : 0x%x and NPTR : 0x%x\n",(unsigned int)list_iter,(unsigned int)PPTR(list_iter),(unsigned int)NPTR(list_iter));
+				printf("mm_check : block %p is points invalid free blocks where PPTR : %p and NPTR : %p\n",list_iter,(void *)PPTR(list_iter),(void *)NPTR(list_iter));
 				return 0;
 			}
 		}
@@ -641,13 +1050,13 @@ static int mm_check(void)
 			
 			/* Is every free block actually in the free list? */
 			if(!isListed(heap_iter)){
-				printf("mm_check : block 0x%x is free but not in the free list\n",(unsigned int)heap_iter);
+				printf("mm_check : block %p is free but not in the free list\n",heap_iter);
 				return 0;
 			}
 			
 			/* Are there any contiguous free blocks that somehow escaped coalescing?  */
 			if(!GET_ALLOC(HDRP(NEXT_BLKP(heap_iter)))){
-				printf("mm_check : block 0x%x and 0x%x are contiguous of free blocks\n",(unsigned int)heap_iter,(unsigned int)NEXT_BLKP(heap_iter));
+				printf("mm_check : block %p and %p are contiguous of free blocks\n",heap_iter,(void *)NEXT_BLKP(heap_iter));
 				return 0;
 			}
 		}
@@ -5,6 +5,18 @@ extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
 
+/* Description of the size class table compiled into mm.c */
+extern const char *mm_sizeclass;
+
+/* Free space of the heap, filled in by mm_heapstats */
+typedef struct {
+    size_t free_blocks;  /* number of free blocks */
+    size_t free_bytes;   /* their total size, headers included */
+    size_t largest_free; /* size of the largest one */
+} mm_heapstats_t;
+
+extern void mm_heapstats(mm_heapstats_t *hs);
+
 
 /* 
  * Students work in teams of one or two.  Teams enter their team name, 
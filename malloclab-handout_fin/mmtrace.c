@@ -0,0 +1,133 @@
+/*
+ * mmtrace.c - Record mm package events into a lock-free ring buffer
+ *
+ * Callers claim a slot with one atomic fetch-and-add on the ticket
+ * counter, fill it and publish it through the slot's ready word. The
+ * ring is split into two halves; whoever fills the last slot of a half
+ * waits for the other slots of that half to be published and writes
+ * the half to the trace file, so there is no lock and no copy. A
+ * caller only ever waits when the ring is full, i.e. when it would
+ * overwrite a half that is not on disk yet.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "mmtrace.h"
+
+#define RING_SIZE (1<<14)          /* records in the ring (512 KB) */
+#define HALF_SIZE (RING_SIZE/2)    /* records written per flush */
+
+static mmtrace_rec_t ring[RING_SIZE];
+static volatile unsigned long ready[RING_SIZE]; /* ticket+1 once a slot is filled */
+static volatile unsigned long tickets;          /* next ticket to hand out */
+static volatile unsigned long flushed;          /* tickets below this are on disk */
+
+static int trace_fd = -1;      /* -1 while tracing is off */
+static uint64_t start_ns;      /* timestamp of the first event */
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+static void trace_open(void);
+static void flush_range(unsigned long lo, unsigned long hi);
+static uint64_t now_ns(void);
+
+/*
+ * mmtrace_event - record one event of the mm package
+ */
+void mmtrace_event(int op, void *addr, void *oldaddr, size_t size)
+{
+    unsigned long t;
+    mmtrace_rec_t *r;
+
+    pthread_once(&once, trace_open);
+    if (trace_fd < 0)
+	return;
+
+    t = __sync_fetch_and_add(&tickets, 1);
+    while (t >= flushed + RING_SIZE) /* ring is full, wait for the flusher */
+	sched_yield();
+
+    r = &ring[t % RING_SIZE];
+    r->ts = now_ns() - start_ns;
+    r->addr = (uint64_t)(unsigned long)addr;
+    r->oldaddr = (uint64_t)(unsigned long)oldaddr;
+    r->size = (uint32_t)size;
+    r->op = op;
+    __sync_synchronize();
+    ready[t % RING_SIZE] = t + 1;
+
+    if ((t + 1) % HALF_SIZE == 0)
+	flush_range(t + 1 - HALF_SIZE, t + 1);
+}
+
+/*
+ * mmtrace_flush - write the records that did not fill a half yet.
+ *     Registered with atexit(), must not race with mmtrace_event().
+ */
+void mmtrace_flush(void)
+{
+    /* flushed is at a half boundary, so the rest never wraps the ring */
+    if (trace_fd >= 0 && tickets != flushed)
+	flush_range(flushed, tickets);
+}
+
+/*
+ * trace_open - open the trace file named by MM_TRACE_FILE, if any
+ */
+static void trace_open(void)
+{
+    char *path = getenv("MM_TRACE_FILE");
+    mmtrace_hdr_t hdr = { MMTRACE_MAGIC, MMTRACE_VERSION };
+
+    if (path == NULL)
+	return;
+    if ((trace_fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644)) < 0) {
+	perror(path);
+	return;
+    }
+    if (write(trace_fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+	perror("mmtrace: write");
+	close(trace_fd);
+	trace_fd = -1;
+	return;
+    }
+    start_ns = now_ns();
+    atexit(mmtrace_flush);
+}
+
+/*
+ * flush_range - write the records of tickets [lo, hi) to the trace file.
+ *     The range never wraps around the end of the ring.
+ */
+static void flush_range(unsigned long lo, unsigned long hi)
+{
+    unsigned long t;
+    size_t len = (hi - lo) * sizeof(mmtrace_rec_t);
+
+    /* halves go to disk in order, and only once all their slots are filled */
+    while (flushed != lo)
+	sched_yield();
+    for (t = lo; t < hi; t++)
+	while (ready[t % RING_SIZE] != t + 1)
+	    sched_yield();
+
+    if (write(trace_fd, &ring[lo % RING_SIZE], len) != (ssize_t)len)
+	perror("mmtrace: write");
+    __sync_synchronize();
+    flushed = hi;
+}
+
+/*
+ * now_ns - monotonic clock in nanoseconds
+ */
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
@@ -0,0 +1,42 @@
+/*
+ * mmtrace.h - Allocation event tracing for mm.c
+ *
+ * When mm.c is built with -DMM_TRACE, every call of the mm package is
+ * recorded by mmtrace_event() and written to the file named by the
+ * MM_TRACE_FILE environment variable (nothing is recorded if it is
+ * unset). The file is an mmtrace_hdr_t followed by mmtrace_rec_t
+ * records in host byte order. Use trace2rep to convert it to a .rep
+ * trace for mdriver.
+ */
+#ifndef __MMTRACE_H_
+#define __MMTRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MMTRACE_MAGIC   0x52544d4d  /* "MMTR" */
+#define MMTRACE_VERSION 1
+
+/* Event types */
+#define MMT_INIT    0  /* mm_init: start of a new run on an empty heap */
+#define MMT_MALLOC  1  /* addr = mm_malloc(size) */
+#define MMT_FREE    2  /* mm_free(addr) */
+#define MMT_REALLOC 3  /* addr = mm_realloc(oldaddr, size) */
+
+typedef struct {
+    uint32_t magic;    /* MMTRACE_MAGIC */
+    uint32_t version;  /* MMTRACE_VERSION */
+} mmtrace_hdr_t;
+
+typedef struct {
+    uint64_t ts;       /* nanoseconds since the first event */
+    uint64_t addr;     /* block returned (malloc/realloc) or freed */
+    uint64_t oldaddr;  /* block passed to realloc, 0 otherwise */
+    uint32_t size;     /* requested payload size */
+    uint32_t op;       /* MMT_xxx */
+} mmtrace_rec_t;
+
+void mmtrace_event(int op, void *addr, void *oldaddr, size_t size);
+void mmtrace_flush(void);
+
+#endif /* __MMTRACE_H_ */
@@ -0,0 +1,120 @@
+/*
+ * perfctr.c - Hardware performance counters via perf_event_open(2)
+ *     (see perfctr.h)
+ *
+ * The counters are opened one by one, not as a group, so a missing
+ * event does not take the others down with it. When the PMU has to
+ * multiplex them, each value is scaled by time enabled / time running.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "perfctr.h"
+
+static const char *names[PC_NUM] = {
+    "instr", "cache-miss", "branch-miss", "dTLB-miss"
+};
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+static int fds[PC_NUM] = {-1, -1, -1, -1};
+
+/*
+ * open_event - open one counter of the calling thread, disabled
+ */
+static int open_event(uint32_t type, uint64_t config)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+int perfctr_open(void)
+{
+    int i, n = 0;
+
+    fds[0] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    fds[1] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    fds[2] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    fds[3] = open_event(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB
+			| (PERF_COUNT_HW_CACHE_OP_READ << 8)
+			| (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    for (i = 0; i < PC_NUM; i++)
+	if (fds[i] >= 0)
+	    n++;
+    return n;
+}
+
+void perfctr_start(void)
+{
+    int i;
+
+    for (i = 0; i < PC_NUM; i++) {
+	if (fds[i] < 0)
+	    continue;
+	ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+	ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+void perfctr_stop(double count[PC_NUM])
+{
+    uint64_t val[3]; /* value, time enabled, time running */
+    int i;
+
+    for (i = 0; i < PC_NUM; i++)
+	if (fds[i] >= 0)
+	    ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+    for (i = 0; i < PC_NUM; i++) {
+	if (fds[i] < 0 || read(fds[i], val, sizeof(val)) != sizeof(val))
+	    continue;
+	if (val[2] == 0) /* never scheduled on the PMU */
+	    continue;
+	count[i] += (double)val[0] * val[1] / val[2];
+    }
+}
+
+int perfctr_avail(int i)
+{
+    return fds[i] >= 0;
+}
+
+#else /* no perf events */
+
+int perfctr_open(void)
+{
+    return 0;
+}
+
+void perfctr_start(void)
+{
+}
+
+void perfctr_stop(double count[PC_NUM])
+{
+}
+
+int perfctr_avail(int i)
+{
+    return 0;
+}
+
+#endif /* __linux__ */
+
+const char *perfctr_name(int i)
+{
+    return names[i];
+}
@@ -0,0 +1,30 @@
+/*
+ * perfctr.h - Hardware performance counters for mdriver
+ *
+ * Counts instructions, cache misses, branch misses and dTLB load misses
+ * of the calling thread (user mode only) with perf_event_open(2). Any
+ * counter the kernel or the CPU refuses is just left out, on systems
+ * without perf events none is available.
+ */
+#ifndef __PERFCTR_H_
+#define __PERFCTR_H_
+
+#define PC_NUM 4 /* number of counters */
+
+/* Open the counters and return how many are available */
+int perfctr_open(void);
+
+/* Zero and start the counters */
+void perfctr_start(void);
+
+/* Stop the counters and add their values to count[] (unavailable ones
+   are left alone) */
+void perfctr_stop(double count[PC_NUM]);
+
+/* Is counter i available? */
+int perfctr_avail(int i);
+
+/* Short name of counter i */
+const char *perfctr_name(int i);
+
+#endif /* __PERFCTR_H_ */
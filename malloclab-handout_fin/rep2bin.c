@@ -0,0 +1,93 @@
+/*
+ * rep2bin.c - Convert a .rep text trace into a binary trace (see
+ *     bintrace.h) that mdriver mmaps and replays without parsing.
+ *
+ * Every id is checked against the header here, so mdriver can trust
+ * the records of a binary trace.
+ *
+ * usage: rep2bin <in.rep> <out.bin>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bintrace.h"
+
+static void rep_error(char *path, int opnum, char *msg);
+
+int main(int argc, char **argv)
+{
+    FILE *in, *out;
+    bintrace_hdr_t hdr;
+    traceop_t op;
+    char type[2];
+    int i;
+
+    if (argc != 3) {
+	fprintf(stderr, "usage: %s <in.rep> <out.bin>\n", argv[0]);
+	exit(1);
+    }
+    if ((in = fopen(argv[1], "r")) == NULL) {
+	perror(argv[1]);
+	exit(1);
+    }
+    hdr.magic = BINTRACE_MAGIC;
+    hdr.version = BINTRACE_VERSION;
+    if (fscanf(in, "%d %d %d %d", &hdr.sugg_heapsize, &hdr.num_ids,
+	       &hdr.num_ops, &hdr.weight) != 4
+	|| hdr.num_ids < 0 || hdr.num_ops < 0)
+	rep_error(argv[1], -1, "bad header");
+
+    if ((out = fopen(argv[2], "wb")) == NULL) {
+	perror(argv[2]);
+	exit(1);
+    }
+    fwrite(&hdr, sizeof(hdr), 1, out);
+
+    for (i = 0; i < hdr.num_ops; i++) {
+	if (fscanf(in, "%1s %d", type, &op.index) != 2)
+	    rep_error(argv[1], i, "missing request");
+	op.size = 0;
+	switch (type[0]) {
+	case 'a':
+	    op.type = ALLOC;
+	    break;
+	case 'r':
+	    op.type = REALLOC;
+	    break;
+	case 'f':
+	    op.type = FREE;
+	    break;
+	default:
+	    rep_error(argv[1], i, "bogus request type");
+	}
+	if (op.type != FREE && fscanf(in, "%d", &op.size) != 1)
+	    rep_error(argv[1], i, "missing size");
+	if (op.index < 0 || op.index >= hdr.num_ids)
+	    rep_error(argv[1], i, "id out of range");
+	if (op.size < 0)
+	    rep_error(argv[1], i, "negative size");
+	fwrite(&op, sizeof(op), 1, out);
+    }
+    if (fscanf(in, "%1s", type) == 1)
+	rep_error(argv[1], i, "more requests than the header says");
+    fclose(in);
+
+    if (fclose(out) != 0) {
+	perror(argv[2]);
+	exit(1);
+    }
+    return 0;
+}
+
+/*
+ * rep_error - report a malformed .rep trace and exit. Request opnum is
+ *     on line opnum+5 of the file, as in mdriver.
+ */
+static void rep_error(char *path, int opnum, char *msg)
+{
+    if (opnum < 0)
+	fprintf(stderr, "%s: %s\n", path, msg);
+    else
+	fprintf(stderr, "%s:%d: %s\n", path, opnum + 5, msg);
+    exit(1);
+}
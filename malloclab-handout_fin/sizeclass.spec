@@ -0,0 +1,31 @@
+#
+# sizeclass.spec - size class table for the segregated free lists in mm.c
+#
+# mkclass turns this file into sizeclass.h at build time, so the class
+# boundaries can be tuned to a size histogram without touching mm.c.
+# Build with another spec with "make CLASSSPEC=<file>".
+#
+#   name   label reported by mdriver -v
+#   min    upper bound of the first class (the minimum free block size)
+#   base   upper bound of the second class, where the geometric series
+#          starts (defaults to min)
+#   max    upper bound of the last bounded class; bigger blocks share
+#          one final open ended class
+#   ratio  each class upper bound is the previous one times ratio...
+#   align  ...rounded up to a multiple of align bytes
+#   lut    block sizes up to lut bytes are mapped with a direct lookup
+#          table, bigger ones with a binary search over the boundaries
+#   bound  (optional, repeatable) pin an extra class boundary
+#
+# Lines starting with '#' are comments.
+#
+# This is the original table of mm.c: one class for the 24 byte minimum
+# block, then powers of two from 32 bytes up to 512 KB (17 classes).
+#
+name   pow2
+min    24
+base   32
+max    524288
+ratio  2
+align  8
+lut    4096
@@ -0,0 +1,226 @@
+/*
+ * trace2rep.c - Convert a binary mm event trace (see mmtrace.h) into
+ *     the .rep text format read by mdriver.
+ *
+ * Every block returned by mm_malloc gets a new id; frees and reallocs
+ * are mapped back to the id of the block at that address. mdriver runs
+ * mm_init several times per trace, so a recording usually holds several
+ * runs separated by MMT_INIT events; by default only the first run is
+ * converted.
+ *
+ * usage: trace2rep [-b] [-r <run>] <tracefile> > out.rep
+ *     -b        free the blocks still live at the end (a balanced trace)
+ *     -r <run>  convert run number <run> (1 = first, 0 = ignore runs)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "mmtrace.h"
+
+#define HASHSIZE (1<<20)  /* buckets of the address -> id table */
+
+/* One live block */
+typedef struct block_t {
+    uint64_t addr;
+    int id;
+    unsigned size;
+    struct block_t *next;
+} block_t;
+
+/* One output request */
+typedef struct {
+    char type;   /* 'a', 'r' or 'f' */
+    int id;
+    unsigned size;
+} repop_t;
+
+static block_t *table[HASHSIZE];
+static repop_t *ops;
+static int num_ops, max_ops;
+static int num_ids;
+static long live_bytes, peak_bytes;
+
+static void emit(char type, int id, unsigned size);
+static void insert_block(uint64_t addr, int id, unsigned size);
+static block_t *remove_block(uint64_t addr);
+static unsigned hash(uint64_t addr);
+static void usage(char *prog);
+
+int main(int argc, char **argv)
+{
+    FILE *fp;
+    mmtrace_hdr_t hdr;
+    mmtrace_rec_t r;
+    block_t *b;
+    int c, i, run = 0, want = 1, balance = 0, unknown = 0;
+
+    while ((c = getopt(argc, argv, "br:h")) != EOF) {
+	switch (c) {
+	case 'b':
+	    balance = 1;
+	    break;
+	case 'r':
+	    want = atoi(optarg);
+	    break;
+	default:
+	    usage(argv[0]);
+	}
+    }
+    if (optind != argc - 1)
+	usage(argv[0]);
+
+    if ((fp = fopen(argv[optind], "rb")) == NULL) {
+	perror(argv[optind]);
+	exit(1);
+    }
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || hdr.magic != MMTRACE_MAGIC
+	|| hdr.version != MMTRACE_VERSION) {
+	fprintf(stderr, "%s: not an mm event trace\n", argv[optind]);
+	exit(1);
+    }
+
+    while (fread(&r, sizeof(r), 1, fp) == 1) {
+	if (r.op == MMT_INIT) {
+	    run++;
+	    continue;
+	}
+	if (want && (run ? run : 1) != want)
+	    continue;
+
+	switch (r.op) {
+	case MMT_MALLOC:
+	    if (r.addr == 0) /* failed or zero sized request */
+		break;
+	    insert_block(r.addr, num_ids, r.size);
+	    emit('a', num_ids++, r.size);
+	    break;
+	case MMT_FREE:
+	    if ((b = remove_block(r.addr)) == NULL) {
+		unknown++;
+		break;
+	    }
+	    emit('f', b->id, 0);
+	    free(b);
+	    break;
+	case MMT_REALLOC:
+	    if (r.oldaddr == 0) { /* realloc(NULL, size) is a malloc */
+		if (r.addr == 0)
+		    break;
+		insert_block(r.addr, num_ids, r.size);
+		emit('a', num_ids++, r.size);
+		break;
+	    }
+	    if ((b = remove_block(r.oldaddr)) == NULL) {
+		unknown++;
+		break;
+	    }
+	    if (r.size == 0) /* realloc(ptr, 0) is a free */
+		emit('f', b->id, 0);
+	    else if (r.addr != 0) {
+		insert_block(r.addr, b->id, r.size);
+		emit('r', b->id, r.size);
+	    }
+	    else /* a failed realloc leaves the old block alone */
+		insert_block(r.oldaddr, b->id, b->size);
+	    free(b);
+	    break;
+	default:
+	    fprintf(stderr, "Bogus event type %u in %s\n", r.op, argv[optind]);
+	    exit(1);
+	}
+    }
+    fclose(fp);
+
+    if (balance)
+	for (i = 0; i < HASHSIZE; i++)
+	    for (b = table[i]; b != NULL; b = b->next)
+		emit('f', b->id, 0);
+    if (unknown)
+	fprintf(stderr, "trace2rep: ignored %d frees of unknown blocks\n",
+		unknown);
+    if (num_ids == 0) {
+	fprintf(stderr, "trace2rep: no allocations in run %d\n", want);
+	exit(1);
+    }
+
+    /* The header: suggested heap size, ids, ops, weight */
+    printf("%ld\n%d\n%d\n1\n", peak_bytes, num_ids, num_ops);
+    for (i = 0; i < num_ops; i++) {
+	if (ops[i].type == 'f')
+	    printf("f %d\n", ops[i].id);
+	else
+	    printf("%c %d %u\n", ops[i].type, ops[i].id, ops[i].size);
+    }
+    return 0;
+}
+
+/*
+ * emit - append one request to the output
+ */
+static void emit(char type, int id, unsigned size)
+{
+    if (num_ops == max_ops) {
+	max_ops = max_ops ? 2*max_ops : 4096;
+	if ((ops = realloc(ops, max_ops * sizeof(repop_t))) == NULL) {
+	    perror("realloc");
+	    exit(1);
+	}
+    }
+    ops[num_ops].type = type;
+    ops[num_ops].id = id;
+    ops[num_ops].size = size;
+    num_ops++;
+}
+
+/*
+ * insert_block - remember that block id of size bytes lives at addr
+ */
+static void insert_block(uint64_t addr, int id, unsigned size)
+{
+    block_t *b;
+    unsigned h = hash(addr);
+
+    if ((b = malloc(sizeof(block_t))) == NULL) {
+	perror("malloc");
+	exit(1);
+    }
+    b->addr = addr;
+    b->id = id;
+    b->size = size;
+    b->next = table[h];
+    table[h] = b;
+
+    live_bytes += size;
+    if (live_bytes > peak_bytes)
+	peak_bytes = live_bytes;
+}
+
+/*
+ * remove_block - unlink and return the live block at addr (NULL if none)
+ */
+static block_t *remove_block(uint64_t addr)
+{
+    block_t *b, **pp;
+
+    for (pp = &table[hash(addr)]; (b = *pp) != NULL; pp = &b->next) {
+	if (b->addr == addr) {
+	    *pp = b->next;
+	    live_bytes -= b->size;
+	    return b;
+	}
+    }
+    return NULL;
+}
+
+static unsigned hash(uint64_t addr)
+{
+    return (unsigned)((addr >> 3) * 0x9E3779B97F4A7C15ULL >> 44) & (HASHSIZE-1);
+}
+
+static void usage(char *prog)
+{
+    fprintf(stderr, "usage: %s [-b] [-r <run>] <tracefile>\n", prog);
+    exit(1);
+}
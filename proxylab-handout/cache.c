@@ -0,0 +1,236 @@
+/*
+ * cache.c - web object cache of the proxy.
+ *
+ * Responses of at most MAX_OBJECT_SIZE bytes are kept in memory, keyed by the normalized URL of their request
+ * (see cache_key), MAX_CACHE_SIZE bytes of objects in total.
+ *
+ * The cache is split into NSHARDS shards by the hash of the key. Each shard has its own hash table and a
+ * readers-writer lock, so lookups of different objects never wait for each other and hits of the same object
+ * only share a read lock. Recency is approximated with CLOCK instead of an exact LRU list, because moving an
+ * object in a list would need the write lock on every hit : a hit only sets the object's 'referenced' bit.
+ * The objects of a shard form a ring, and when the cache is full the clock hand of a shard walks it, clearing
+ * referenced bits and evicting the first object whose bit is already clear. Shards are picked for eviction
+ * round robin('victim'), so the cache as a whole evicts about as an LRU would.
+ *
+ * cache_size and victim are shared by every shard and only updated atomically. A hit copies the object out
+ * under the read lock, so the caller never sees an object that is being evicted.
+ */
+#include "csapp.h"
+#include "cache.h"
+
+#define NSHARDS 16 /* number of shards */
+#define NBUCKETS 256 /* hash table size of each shard */
+
+/* One cached object */
+typedef struct object {
+	char *key; // normalized URL
+	char *data; // the whole response
+	int size; // bytes in data
+	int referenced; // set by hits, cleared by the clock hand
+	struct object *prev; // previous object in the ring of the shard
+	struct object *next; // next object in the ring of the shard
+	struct object *hnext; // next object in the same hash bucket
+} object_t;
+
+/* One shard of the cache */
+typedef struct {
+	pthread_rwlock_t lock; // protects everything below
+	object_t *table[NBUCKETS];
+	object_t *hand; // next object the clock hand looks at, NULL if the shard is empty
+} shard_t;
+
+static shard_t shards[NSHARDS];
+static int cache_size; // total bytes of cached objects, including the ones being inserted
+static unsigned int victim; // the next shard to evict from
+
+static unsigned int hash(char *key);
+static object_t *lookup(shard_t *sh, unsigned int h, char *key);
+static int evict(shard_t *sh);
+static void free_object(object_t *obj);
+
+/*
+ * cache_init - initialize the empty cache. Call before starting any thread.
+ */
+void cache_init(void)
+{
+	int i, rc;
+
+	for(i=0;i<NSHARDS;i++)
+		if((rc = pthread_rwlock_init(&shards[i].lock, NULL)) != 0)
+			posix_error(rc, "pthread_rwlock_init error");
+}
+
+/*
+ * cache_key - make the normalized URL of a request in key(MAXLINE bytes) :
+ *             lower case hostname, explicit port and the request path, so "http://Host/x" and
+ *             "http://host:80/x" share one object.
+ */
+void cache_key(char *key, char *hostname, char *port, char *request)
+{
+	int i;
+
+	snprintf(key, MAXLINE, "%s:%s%s", hostname, port, *request ? request : "/");
+	for(i=0;key[i] && key[i]!=':';i++)
+		key[i] = tolower((unsigned char)key[i]);
+}
+
+/*
+ * cache_find - if the object of key is cached, copy it to buf(MAX_OBJECT_SIZE bytes), mark it as referenced
+ *              and return its size. Otherwise return -1.
+ */
+int cache_find(char *key, char *buf)
+{
+	unsigned int h = hash(key);
+	shard_t *sh = &shards[h % NSHARDS];
+	object_t *obj;
+	int size = -1;
+
+	pthread_rwlock_rdlock(&sh->lock);
+	if((obj = lookup(sh, h, key)) != NULL){
+		memcpy(buf, obj->data, obj->size);
+		size = obj->size;
+		__atomic_store_n(&obj->referenced, 1, __ATOMIC_RELAXED); // other readers may set it as well
+	}
+	pthread_rwlock_unlock(&sh->lock);
+	return size;
+}
+
+/*
+ * cache_insert - cache a copy of the response of key(size bytes), evicting objects until it fits.
+ *                Responses bigger than MAX_OBJECT_SIZE or other than 200 aren't cached, and an object already cached is kept.
+ */
+void cache_insert(char *key, char *data, int size)
+{
+	unsigned int h = hash(key);
+	shard_t *sh = &shards[h % NSHARDS];
+	object_t *obj;
+	int misses = 0; // shards in a row that had nothing to evict
+
+	if(size > MAX_OBJECT_SIZE) return;
+
+	/* only successful responses are worth keeping */
+	if(size < 12 || strncmp(data, "HTTP/1.", 7) || strncmp(data + 8, " 200", 4)) return;
+
+	/* copy the object before taking any lock */
+	if((obj = malloc(sizeof(object_t))) == NULL) return;
+	obj->key = strdup(key);
+	obj->data = malloc(size);
+	if(obj->key == NULL || obj->data == NULL){
+		free_object(obj);
+		return;
+	}
+	memcpy(obj->data, data, size);
+	obj->size = size;
+	obj->referenced = 0;
+
+	/* reserve the space, then evict until the cache fits again(holding one shard lock at a time) */
+	__atomic_add_fetch(&cache_size, size, __ATOMIC_RELAXED);
+	while(__atomic_load_n(&cache_size, __ATOMIC_RELAXED) > MAX_CACHE_SIZE){
+		if(evict(&shards[__atomic_fetch_add(&victim, 1, __ATOMIC_RELAXED) % NSHARDS]))
+			misses = 0;
+		else if(++misses == NSHARDS){
+			/* the rest is reserved by inserts in progress, give up on this one */
+			__atomic_sub_fetch(&cache_size, size, __ATOMIC_RELAXED);
+			free_object(obj);
+			return;
+		}
+	}
+
+	pthread_rwlock_wrlock(&sh->lock);
+	if(lookup(sh, h, key) != NULL){
+		/* another connection cached it meanwhile */
+		pthread_rwlock_unlock(&sh->lock);
+		__atomic_sub_fetch(&cache_size, size, __ATOMIC_RELAXED);
+		free_object(obj);
+		return;
+	}
+	obj->hnext = sh->table[(h / NSHARDS) % NBUCKETS];
+	sh->table[(h / NSHARDS) % NBUCKETS] = obj;
+
+	/* put it right behind the hand, so the hand gets to it last */
+	if(sh->hand == NULL){
+		obj->prev = obj->next = obj;
+		sh->hand = obj;
+	}
+	else{
+		obj->next = sh->hand;
+		obj->prev = sh->hand->prev;
+		obj->prev->next = obj;
+		sh->hand->prev = obj;
+	}
+	pthread_rwlock_unlock(&sh->lock);
+}
+
+/*
+ * hash - FNV-1a hash of key. The shard is hash % NSHARDS, the bucket in the shard (hash / NSHARDS) % NBUCKETS.
+ */
+static unsigned int hash(char *key)
+{
+	unsigned int h = 2166136261u;
+
+	while(*key)
+		h = (h ^ (unsigned char)*key++) * 16777619u;
+	return h;
+}
+
+/*
+ * lookup - return the cached object of key(whose hash is h) in shard sh, or NULL. The caller holds sh->lock.
+ */
+static object_t *lookup(shard_t *sh, unsigned int h, char *key)
+{
+	object_t *obj;
+
+	for(obj = sh->table[(h / NSHARDS) % NBUCKETS]; obj != NULL; obj = obj->hnext)
+		if(!strcmp(obj->key, key)) return obj;
+	return NULL;
+}
+
+/*
+ * evict - run the clock hand of shard sh until it finds an object that wasn't referenced since the hand
+ *         last passed it, remove that object and free it. Return 0 if the shard is empty.
+ */
+static int evict(shard_t *sh)
+{
+	object_t *obj;
+	object_t **pp;
+
+	pthread_rwlock_wrlock(&sh->lock);
+	if(sh->hand == NULL){
+		pthread_rwlock_unlock(&sh->lock);
+		return 0;
+	}
+
+	/* at most one full turn clears every referenced bit */
+	while(sh->hand->referenced){
+		sh->hand->referenced = 0;
+		sh->hand = sh->hand->next;
+	}
+	obj = sh->hand;
+
+	/* remove it from the ring and from its bucket */
+	if(obj->next == obj)
+		sh->hand = NULL;
+	else{
+		obj->prev->next = obj->next;
+		obj->next->prev = obj->prev;
+		sh->hand = obj->next;
+	}
+	for(pp = &sh->table[(hash(obj->key) / NSHARDS) % NBUCKETS]; *pp != obj; pp = &(*pp)->hnext)
+		;
+	*pp = obj->hnext;
+	pthread_rwlock_unlock(&sh->lock);
+
+	__atomic_sub_fetch(&cache_size, obj->size, __ATOMIC_RELAXED);
+	free_object(obj);
+	return 1;
+}
+
+/*
+ * free_object - free obj and what it points to
+ */
+static void free_object(object_t *obj)
+{
+	free(obj->key);
+	free(obj->data);
+	free(obj);
+}
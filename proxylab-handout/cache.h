@@ -0,0 +1,16 @@
+/*
+ * cache.h - web object cache shared by every connection of the proxy.
+ */
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+/* Recommended max cache and object sizes */
+#define MAX_CACHE_SIZE 1049000
+#define MAX_OBJECT_SIZE 102400
+
+void cache_init(void);
+void cache_key(char *key, char *hostname, char *port, char *request);
+int cache_find(char *key, char *buf);
+void cache_insert(char *key, char *obj, int size);
+
+#endif /* __CACHE_H__ */
@@ -0,0 +1,225 @@
+/*
+ * dns.c - resolver cache of end server addresses.
+ *
+ * open_clientfd calls getaddrinfo for every connection, and the proxy connects to the same few end servers
+ * over and over. dns_lookup keeps the addresses of each name(lower case "hostname:port") for DNS_TTL seconds
+ * instead. getaddrinfo doesn't tell the real TTL of the records, so it is a fixed one.
+ *
+ * A name that expired less than DNS_STALE_SECS ago is still answered from the cache, and a detached thread
+ * resolves it again in the background('refreshing' makes sure only one does), so a connection only waits for
+ * the resolver the first time a name is seen or after it went unused for a long time. A failed refresh keeps
+ * the old addresses for DNS_NEG_TTL more seconds. A name that fails to resolve is cached as failed for
+ * DNS_NEG_TTL seconds, so a bad name in many requests doesn't hit the resolver for each of them.
+ *
+ * The names are in one hash table protected by a readers-writer lock : lookups only share the read lock, and
+ * the resolver is never called with the lock held. Names are never removed(only updated), so a refresh thread
+ * can keep a pointer to its name, and at most DNS_MAX_NAMES are cached.
+ */
+#include "csapp.h"
+#include "dns.h"
+
+#define NBUCKETS 256 /* hash table size */
+
+/* One cached name */
+typedef struct name {
+	char *key; // lower case "hostname:port"
+	char *hostname; // as first asked, used to refresh it
+	char *port;
+	dns_addrs_t addrs; // the addresses if error is 0
+	int error; // 0, or the getaddrinfo error of a failed name
+	time_t expires; // addresses are fresh until then, a failed name is failed until then
+	int refreshing; // a refresh thread is resolving it
+	struct name *next; // next name in the same hash bucket
+} name_t;
+
+static name_t *table[NBUCKETS];
+static int nnames; // names in table
+static pthread_rwlock_t lock; // protects everything above
+
+static int resolve(char *hostname, char *port, dns_addrs_t *addrs);
+static void store(char *key, unsigned int h, char *hostname, char *port, dns_addrs_t *addrs, int error);
+static void *refresh(void *vargp);
+static name_t *lookup(unsigned int h, char *key);
+static unsigned int hash(char *key);
+
+/*
+ * dns_init - initialize the empty cache. Call before starting any thread.
+ */
+void dns_init(void)
+{
+	int rc;
+
+	if((rc = pthread_rwlock_init(&lock, NULL)) != 0)
+		posix_error(rc, "pthread_rwlock_init error");
+}
+
+/*
+ * dns_lookup - copy the addresses of hostname:port to addrs, from the cache if it has them.
+ *              Return 0, or -1 if the name can't be resolved.
+ */
+int dns_lookup(char *hostname, char *port, dns_addrs_t *addrs)
+{
+	char key[MAXLINE];
+	unsigned int h;
+	name_t *nm;
+	pthread_t tid;
+	time_t now = time(NULL);
+	int i, rc, stale;
+
+	snprintf(key, MAXLINE, "%s:%s", hostname, port);
+	for(i=0;key[i];i++)
+		key[i] = tolower((unsigned char)key[i]);
+	h = hash(key);
+
+	/* Cached : fresh, or stale and refreshed in the background */
+	pthread_rwlock_rdlock(&lock);
+	if((nm = lookup(h, key)) != NULL && now < nm->expires + (nm->error ? 0 : DNS_STALE_SECS)){
+		if((rc = nm->error ? -1 : 0) == 0)
+			*addrs = nm->addrs;
+		stale = !nm->error && now >= nm->expires && !__atomic_exchange_n(&nm->refreshing, 1, __ATOMIC_RELAXED);
+		pthread_rwlock_unlock(&lock);
+
+		if(stale && pthread_create(&tid, NULL, refresh, nm) != 0)
+			__atomic_store_n(&nm->refreshing, 0, __ATOMIC_RELAXED); // try again on the next lookup
+		return rc;
+	}
+	pthread_rwlock_unlock(&lock);
+
+	/* Not cached, or too old to use : resolve it now */
+	if((rc = resolve(hostname, port, addrs)) != 0)
+		fprintf(stderr, "getaddrinfo failed (%s:%s): %s\n", hostname, port, gai_strerror(rc));
+	store(key, h, hostname, port, addrs, rc);
+	return rc ? -1 : 0;
+}
+
+/*
+ * dns_connect - open_clientfd with the addresses of dns_lookup : open a connection to hostname:port.
+ *               Return the descriptor, -2 if the name can't be resolved, -1 if every address failed.
+ */
+int dns_connect(char *hostname, char *port)
+{
+	dns_addrs_t addrs;
+	int i, fd;
+
+	if(dns_lookup(hostname, port, &addrs) < 0)
+		return -2;
+	for(i=0;i<addrs.n;i++){
+		if((fd = socket(addrs.a[i].family, SOCK_STREAM, 0)) < 0)
+			continue;
+		if(connect(fd, (SA *)&addrs.a[i].addr, addrs.a[i].len) == 0)
+			return fd;
+		close(fd);
+	}
+	return -1;
+}
+
+/*
+ * resolve - getaddrinfo hostname:port like open_clientfd does, and copy the addresses to addrs.
+ *           Return 0 or the getaddrinfo error.
+ */
+static int resolve(char *hostname, char *port, dns_addrs_t *addrs)
+{
+	struct addrinfo hints, *listp, *p;
+	int rc;
+
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG;
+	if((rc = getaddrinfo(hostname, port, &hints, &listp)) != 0)
+		return rc;
+
+	addrs->n = 0;
+	for(p = listp; p && addrs->n < DNS_MAX_ADDRS; p = p->ai_next){
+		addrs->a[addrs->n].family = p->ai_family;
+		addrs->a[addrs->n].len = p->ai_addrlen;
+		memcpy(&addrs->a[addrs->n].addr, p->ai_addr, p->ai_addrlen);
+		addrs->n++;
+	}
+	freeaddrinfo(listp);
+	return 0;
+}
+
+/*
+ * store - cache the result of resolving key(whose hash is h) : its addresses, or its error.
+ */
+static void store(char *key, unsigned int h, char *hostname, char *port, dns_addrs_t *addrs, int error)
+{
+	name_t *nm;
+
+	pthread_rwlock_wrlock(&lock);
+	if((nm = lookup(h, key)) == NULL){
+		/* a new name, if there is room */
+		if(nnames == DNS_MAX_NAMES || (nm = calloc(1, sizeof(name_t))) == NULL){
+			pthread_rwlock_unlock(&lock);
+			return;
+		}
+		nm->key = strdup(key);
+		nm->hostname = strdup(hostname);
+		nm->port = strdup(port);
+		if(nm->key == NULL || nm->hostname == NULL || nm->port == NULL){
+			pthread_rwlock_unlock(&lock);
+			free(nm->key);
+			free(nm->hostname);
+			free(nm->port);
+			free(nm);
+			return;
+		}
+		nm->next = table[h % NBUCKETS];
+		table[h % NBUCKETS] = nm;
+		nnames++;
+	}
+	if(!error)
+		nm->addrs = *addrs;
+	nm->error = error;
+	nm->expires = time(NULL) + (error ? DNS_NEG_TTL : DNS_TTL);
+	pthread_rwlock_unlock(&lock);
+}
+
+/*
+ * refresh - thread routine resolving the stale name vargp again in the background
+ */
+static void *refresh(void *vargp)
+{
+	name_t *nm = vargp;
+	dns_addrs_t addrs;
+	int rc;
+
+	Pthread_detach(pthread_self());
+	rc = resolve(nm->hostname, nm->port, &addrs);
+
+	pthread_rwlock_wrlock(&lock);
+	if(rc == 0){
+		nm->addrs = addrs;
+		nm->error = 0;
+		nm->expires = time(NULL) + DNS_TTL;
+	}
+	else
+		nm->expires = time(NULL) + DNS_NEG_TTL; // keep the old addresses a little longer
+	nm->refreshing = 0;
+	pthread_rwlock_unlock(&lock);
+	return NULL;
+}
+
+/*
+ * lookup - return the cached name of key(whose hash is h), or NULL. The caller holds lock.
+ */
+static name_t *lookup(unsigned int h, char *key)
+{
+	name_t *nm;
+
+	for(nm = table[h % NBUCKETS]; nm != NULL; nm = nm->next)
+		if(!strcmp(nm->key, key)) return nm;
+	return NULL;
+}
+
+/*
+ * hash - FNV-1a hash of key
+ */
+static unsigned int hash(char *key)
+{
+	unsigned int h = 2166136261u;
+
+	while(*key)
+		h = (h ^ (unsigned char)*key++) * 16777619u;
+	return h;
+}
@@ -0,0 +1,29 @@
+/*
+ * dns.h - resolver cache of end server addresses, shared by every connection of the proxy.
+ */
+#ifndef __DNS_H__
+#define __DNS_H__
+
+#include "csapp.h"
+
+#define DNS_MAX_ADDRS 8      /* max addresses kept per name */
+#define DNS_TTL 60           /* seconds a resolved name is used before it is refreshed */
+#define DNS_STALE_SECS 300   /* an expired name is still used this long while it is refreshed in the background */
+#define DNS_NEG_TTL 5        /* seconds a name that failed to resolve stays failed */
+#define DNS_MAX_NAMES 1024   /* max names cached, more are resolved every time */
+
+/* Addresses of one end server, in getaddrinfo order */
+typedef struct {
+	int n; // number of addresses
+	struct {
+		int family;
+		socklen_t len;
+		struct sockaddr_storage addr;
+	} a[DNS_MAX_ADDRS];
+} dns_addrs_t;
+
+void dns_init(void);
+int dns_lookup(char *hostname, char *port, dns_addrs_t *addrs);
+int dns_connect(char *hostname, char *port);
+
+#endif /* __DNS_H__ */
@@ -0,0 +1,421 @@
+/*
+ * epoll.c - event driven engine of the proxy(proxy -e epoll).
+ *
+ * One thread serves every connection. All sockets are nonblocking and watched by one level triggered
+ * epoll instance. Each client connection has a conn_t which moves through these states :
+ *
+ *   READ_REQ : read the request header from the client, up to the blank line
+ *   CONNECT  : wait for the nonblocking connect to the end server(the next address is tried if it fails)
+ *   SEND_REQ : write the forwarding request to the end server
+ *   RELAY    : copy the end server's response to the client through buf
+ *   SEND_OBJ : write an object found in the cache to the client
+ *   SEND_ERR : write an error response to a request this engine doesn't serve(one with a body)
+ *   DRAIN    : drop what the client still sends after the error response, until it closes
+ *
+ * and it is closed when the end server closes or on any error. Only one socket of a connection is watched
+ * at a time : while the client can't take more of the response, the end server isn't read, so a connection
+ * never holds more than one buffer, plus the copy of a response to GET kept for the cache. The end server's
+ * addresses come from the resolver cache of dns.c, so only a name that isn't cached yet blocks the loop.
+ */
+#include <sys/epoll.h>
+#include "csapp.h"
+#include "proxy.h"
+#include "cache.h"
+#include "dns.h"
+
+#define MAXEVENTS 1024 /* max number of events taken from one epoll_wait */
+
+/* States of a connection */
+enum { READ_REQ, CONNECT, SEND_REQ, RELAY, SEND_OBJ, SEND_ERR, DRAIN };
+
+typedef struct conn conn_t;
+
+/* One socket of a connection, epoll hands it back as the event's data */
+typedef struct {
+	conn_t *conn;
+	int fd;
+	unsigned int events; // events it is registered for, 0 if not registered
+} endpoint_t;
+
+struct conn {
+	int state;
+	endpoint_t client; // socket from the client
+	endpoint_t server; // socket to the end server, fd is -1 before connecting
+	dns_addrs_t addrs; // end server addresses
+	int next; // next address to try
+	char req[MAXLINE]; // request header from the client, then the forwarding request
+	http_req_t r; // the request header, as far as it is parsed
+	int reqlen; // bytes in req
+	int reqsent; // bytes of req written to the end server
+	char buf[MAXBUF]; // response bytes read from the end server, or the error response
+	int buflen; // bytes in buf
+	int bufsent; // bytes of buf written to the client
+	char *key; // cache key of a GET request, NULL for other methods
+	char *obj; // MAX_OBJECT_SIZE bytes : the response kept for the cache, or the cached object to send
+	int objlen; // bytes in obj, -1 once the response doesn't fit
+	int objsent; // bytes of a cached obj written to the client
+};
+
+static int epfd; // the epoll instance
+
+static void accept_conns(int listenfd);
+static void read_req(conn_t *c);
+static void connect_server(conn_t *c);
+static void check_connect(conn_t *c);
+static void send_req(conn_t *c);
+static void relay(conn_t *c);
+static void send_obj(conn_t *c);
+static void fail_req(conn_t *c, char *status);
+static void send_err(conn_t *c);
+static void drain(conn_t *c);
+static void close_conn(conn_t *c);
+static int watch(endpoint_t *ep, unsigned int events);
+
+/*
+ * epoll_serve - accept the connections of listenfd and serve all of them from this thread, forever.
+ */
+void epoll_serve(int listenfd)
+{
+	struct epoll_event ev, events[MAXEVENTS];
+	endpoint_t *ep;
+	int i,n;
+
+	if((epfd = epoll_create1(0)) < 0)
+		unix_error("epoll_create1 error");
+	if(fcntl(listenfd, F_SETFL, fcntl(listenfd, F_GETFL) | O_NONBLOCK) < 0)
+		unix_error("fcntl error");
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL; // NULL marks the listening socket
+	if(epoll_ctl(epfd, EPOLL_CTL_ADD, listenfd, &ev) < 0)
+		unix_error("epoll_ctl error");
+
+	while(1){
+		if((n = epoll_wait(epfd, events, MAXEVENTS, -1)) < 0){
+			if(errno == EINTR) continue;
+			unix_error("epoll_wait error");
+		}
+		/* a connection has one registered socket at most, so closing it can't leave a later event dangling */
+		for(i=0;i<n;i++){
+			if((ep = events[i].data.ptr) == NULL){
+				accept_conns(listenfd);
+				continue;
+			}
+			switch(ep->conn->state){
+			case READ_REQ: read_req(ep->conn); break;
+			case CONNECT: check_connect(ep->conn); break;
+			case SEND_REQ: send_req(ep->conn); break;
+			case RELAY: relay(ep->conn); break;
+			case SEND_OBJ: send_obj(ep->conn); break;
+			case SEND_ERR: send_err(ep->conn); break;
+			case DRAIN: drain(ep->conn); break;
+			}
+		}
+	}
+}
+
+/*
+ * accept_conns - accept every pending connection and start reading its request.
+ */
+static void accept_conns(int listenfd)
+{
+	conn_t *c;
+	int fd;
+
+	while((fd = accept(listenfd, NULL, NULL)) >= 0){
+		if(fcntl(fd, F_SETFL, O_NONBLOCK) < 0 || (c = malloc(sizeof(conn_t))) == NULL){
+			close(fd);
+			continue;
+		}
+		c->state = READ_REQ;
+		c->client.conn = c->server.conn = c;
+		c->client.fd = fd;
+		c->server.fd = -1;
+		c->client.events = c->server.events = 0;
+		c->reqlen = c->reqsent = c->buflen = c->bufsent = 0;
+		http_req_init(&c->r);
+		c->key = c->obj = NULL;
+		c->objlen = c->objsent = 0;
+		if(watch(&c->client, EPOLLIN) < 0)
+			close_conn(c);
+	}
+}
+
+/*
+ * read_req - read more of the request header and parse it. Once it is complete, make the forwarding request and
+ *            start connecting to the end server. Request bodies aren't relayed by this engine, such a request is
+ *            answered with 501.
+ */
+static void read_req(conn_t *c)
+{
+	char port[MAXLINE], hostname[MAXLINE], key[MAXLINE], fwreq[MAXLINE];
+	http_hdr_t *h;
+	int i,n;
+
+	n = read(c->client.fd, c->req + c->reqlen, MAXLINE-1 - c->reqlen);
+	if(n < 0 && (errno == EAGAIN || errno == EINTR)) return;
+	if(n <= 0){
+		close_conn(c);
+		return;
+	}
+	c->reqlen += n;
+
+	/* parse what arrived, wait for the rest. A header that doesn't fit in req is dropped */
+	if((n = http_parse_req(&c->r, c->req, c->reqlen)) == HTTP_AGAIN){
+		if(c->reqlen == MAXLINE-1) close_conn(c);
+		return;
+	}
+	if(n == HTTP_BAD){
+		close_conn(c);
+		return;
+	}
+	printf("%.*s\n", c->r.line.len, c->req + c->r.line.off);
+	for(i = 0, h = c->r.hdrs; i < c->r.nhdrs; i++, h++)
+		if(http_span_is(c->req, h->name, "Transfer-Encoding") ||
+		   (http_span_is(c->req, h->name, "Content-Length") && atol(c->req + h->value.off) != 0)){
+			fail_req(c, "501 Not Implemented");
+			return;
+		}
+	if(req_target(c->req, &c->r, hostname, port) < 0 ||
+	   (n = make_req(fwreq, MAXLINE, c->req, &c->r, hostname, 0)) >= MAXLINE-1){
+		close_conn(c);
+		return;
+	}
+
+	/* Serve a cached object straight from memory */
+	if(!strcasecmp(c->req + c->r.method.off, "GET")){
+		cache_key(key, hostname, port, c->req + c->r.path.off);
+		if((c->obj = malloc(MAX_OBJECT_SIZE)) == NULL || (c->key = strdup(key)) == NULL){
+			close_conn(c);
+			return;
+		}
+		if((c->objlen = cache_find(key, c->obj)) >= 0){
+			c->state = SEND_OBJ;
+			if(watch(&c->client, EPOLLOUT) < 0)
+				close_conn(c);
+			return;
+		}
+		c->objlen = 0;
+	}
+
+	/* the client has nothing more to say, now talk to the end server */
+	memcpy(c->req, fwreq, n);
+	c->reqlen = n;
+	if(watch(&c->client, 0) < 0){
+		close_conn(c);
+		return;
+	}
+	if(dns_lookup(hostname, port, &c->addrs) < 0){
+		close_conn(c);
+		return;
+	}
+	c->next = 0;
+	connect_server(c);
+}
+
+/*
+ * connect_server - start a nonblocking connect to the next address of the end server.
+ */
+static void connect_server(conn_t *c)
+{
+	int fd, i;
+
+	while((i = c->next) < c->addrs.n){
+		c->next++;
+		if((fd = socket(c->addrs.a[i].family, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0)
+			continue;
+		if(connect(fd, (SA *)&c->addrs.a[i].addr, c->addrs.a[i].len) == 0 || errno == EINPROGRESS){
+			/* even a connect that finished at once is handled when the socket turns writable */
+			c->state = CONNECT;
+			c->server.fd = fd;
+			if(watch(&c->server, EPOLLOUT) < 0)
+				close_conn(c);
+			return;
+		}
+		close(fd);
+	}
+
+	/* every address failed */
+	close_conn(c);
+}
+
+/*
+ * check_connect - the socket to the end server is writable, see whether the connect succeeded.
+ */
+static void check_connect(conn_t *c)
+{
+	int err = 0;
+	socklen_t len = sizeof(err);
+
+	if(getsockopt(c->server.fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err){
+		/* Connect failed, try another address */
+		close(c->server.fd); // also removes it from epoll
+		c->server.fd = -1;
+		c->server.events = 0;
+		connect_server(c);
+		return;
+	}
+	c->state = SEND_REQ;
+	send_req(c);
+}
+
+/*
+ * send_req - write more of the forwarding request, then wait for the response.
+ */
+static void send_req(conn_t *c)
+{
+	int n;
+
+	n = write(c->server.fd, c->req + c->reqsent, c->reqlen - c->reqsent);
+	if(n < 0 && (errno == EAGAIN || errno == EINTR)) return;
+	if(n < 0){
+		close_conn(c);
+		return;
+	}
+	c->reqsent += n;
+	if(c->reqsent < c->reqlen) return; // still watching for EPOLLOUT
+
+	c->state = RELAY;
+	if(watch(&c->server, EPOLLIN) < 0)
+		close_conn(c);
+}
+
+/*
+ * relay - move the response on : if buf is empty read from the end server, then write buf to the client.
+ *         Watch whichever side has to make progress next.
+ */
+static void relay(conn_t *c)
+{
+	int n;
+
+	if(c->bufsent == c->buflen){
+		n = read(c->server.fd, c->buf, MAXBUF);
+		if(n < 0 && (errno == EAGAIN || errno == EINTR)) return;
+		if(n <= 0){
+			/* end of the response(HTTP/1.0, the end server closes) or an error, cache a whole response that fits */
+			if(n == 0 && c->key && c->objlen > 0)
+				cache_insert(c->key, c->obj, c->objlen);
+			close_conn(c);
+			return;
+		}
+		c->buflen = n;
+		c->bufsent = 0;
+
+		/* keep a copy for the cache while it fits */
+		if(c->key && c->objlen >= 0 && c->objlen + n <= MAX_OBJECT_SIZE){
+			memcpy(c->obj + c->objlen, c->buf, n);
+			c->objlen += n;
+		}
+		else c->objlen = -1;
+	}
+
+	n = write(c->client.fd, c->buf + c->bufsent, c->buflen - c->bufsent);
+	if(n < 0 && errno != EAGAIN && errno != EINTR){
+		close_conn(c); // the client went away
+		return;
+	}
+	if(n > 0) c->bufsent += n;
+
+	if(c->bufsent < c->buflen){
+		/* CASE1 : the client is full, wait until it drains */
+		if(watch(&c->server, 0) < 0 || watch(&c->client, EPOLLOUT) < 0)
+			close_conn(c);
+	}
+	else{
+		/* CASE2 : buf is empty, wait for more of the response */
+		if(watch(&c->client, 0) < 0 || watch(&c->server, EPOLLIN) < 0)
+			close_conn(c);
+	}
+}
+
+/*
+ * send_obj - write more of the cached object to the client, close the connection when it's all written.
+ */
+static void send_obj(conn_t *c)
+{
+	int n;
+
+	n = write(c->client.fd, c->obj + c->objsent, c->objlen - c->objsent);
+	if(n < 0 && (errno == EAGAIN || errno == EINTR)) return;
+	if(n < 0 || (c->objsent += n) == c->objlen)
+		close_conn(c);
+}
+
+/*
+ * fail_req - answer the request with the error_resp of status, then close the connection.
+ */
+static void fail_req(conn_t *c, char *status)
+{
+	c->buflen = error_resp(c->buf, MAXBUF, status);
+	c->bufsent = 0;
+	c->state = SEND_ERR;
+	if(watch(&c->client, EPOLLOUT) < 0)
+		close_conn(c);
+}
+
+/*
+ * send_err - write more of the error response. Once it is sent, stop writing and wait for the client to close
+ *            (DRAIN) : closing a socket with unread data(e.g. the request body) resets the connection, which can
+ *            destroy the response before the client reads it.
+ */
+static void send_err(conn_t *c)
+{
+	int n;
+
+	n = write(c->client.fd, c->buf + c->bufsent, c->buflen - c->bufsent);
+	if(n < 0 && (errno == EAGAIN || errno == EINTR)) return;
+	if(n < 0){
+		close_conn(c);
+		return;
+	}
+	if((c->bufsent += n) < c->buflen)
+		return;
+	c->state = DRAIN;
+	if(shutdown(c->client.fd, SHUT_WR) < 0 || watch(&c->client, EPOLLIN) < 0)
+		close_conn(c);
+}
+
+/*
+ * drain - read and drop what the client sends after the error response, close the connection once it closes.
+ */
+static void drain(conn_t *c)
+{
+	int n;
+
+	n = read(c->client.fd, c->buf, MAXBUF);
+	if(n < 0 && (errno == EAGAIN || errno == EINTR)) return;
+	if(n <= 0)
+		close_conn(c);
+}
+
+/*
+ * close_conn - close both sockets of the connection and free it.
+ */
+static void close_conn(conn_t *c)
+{
+	close(c->client.fd); // closing a socket removes it from epoll
+	if(c->server.fd >= 0)
+		close(c->server.fd);
+	free(c->key);
+	free(c->obj);
+	free(c);
+}
+
+/*
+ * watch - register the endpoint for events(0 unregisters it), nothing to do if it is already registered so.
+ */
+static int watch(endpoint_t *ep, unsigned int events)
+{
+	struct epoll_event ev;
+	int op;
+
+	if(ep->events == events) return 0;
+	if(events == 0) op = EPOLL_CTL_DEL;
+	else if(ep->events == 0) op = EPOLL_CTL_ADD;
+	else op = EPOLL_CTL_MOD;
+
+	ev.events = events;
+	ev.data.ptr = ep;
+	if(epoll_ctl(epfd, op, ep->fd, &ev) < 0) return -1;
+	ep->events = events;
+	return 0;
+}
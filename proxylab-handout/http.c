@@ -0,0 +1,226 @@
+/*
+ * http.c - incremental parser of HTTP request headers.
+ *
+ * http_parse_req is called each time more of a request header has arrived in the buffer, and carries on from
+ * where the previous call stopped(r->pos, in state r->state), so every byte is looked at once however the
+ * header is split between reads. Nothing is copied : the parts of the request(method, URI, host, port, path
+ * and each header's name and value) are recorded as spans of the buffer, which must keep its contents until
+ * the caller is done with them.
+ *
+ * The request line may be preceded by blank lines(left over from the previous request of a connection). Lines
+ * end with CRLF or LF. The host and port come from an absolute URI("http://host:port/path"), or else from the
+ * Host header.
+ */
+#include <string.h>
+#include <strings.h>
+#include "http.h"
+
+/* Parser states */
+enum { S_START, S_METHOD, S_URI_START, S_URI, S_VERSION_START, S_VERSION, S_LINE_LF,
+	S_HDR_START, S_HDR_NAME, S_HDR_OWS, S_HDR_VALUE, S_HDR_LF, S_END_LF, S_DONE };
+
+static int end_line(http_req_t *r, char *buf, int i);
+static void end_header(http_req_t *r, char *buf, int i);
+static void split_host(http_req_t *r, char *buf, int start, int end);
+
+/*
+ * http_req_init - start parsing a new request header
+ */
+void http_req_init(http_req_t *r)
+{
+	r->state = S_START;
+	r->pos = 0;
+	r->host.len = r->port.len = r->path.len = 0;
+	r->nhdrs = 0;
+}
+
+/*
+ * http_parse_req - parse buf[r->pos..len), the bytes that arrived since the last call.
+ *                  Return the length of the header(up to and including the blank line) once it is complete,
+ *                  HTTP_AGAIN if it isn't yet, or HTTP_BAD.
+ */
+int http_parse_req(http_req_t *r, char *buf, int len)
+{
+	int i;
+	char c;
+
+	if(r->state == S_DONE)
+		return r->pos;
+
+	for(i = r->pos; i < len; i++){
+		c = buf[i];
+		switch(r->state){
+		case S_START: // blank lines before the request line
+			if(c == '\r' || c == '\n')
+				break;
+			r->mark = i;
+			r->state = S_METHOD;
+			/* fall through */
+		case S_METHOD:
+			if(c == ' '){
+				if((r->method.len = i - r->mark) == 0) return HTTP_BAD;
+				r->method.off = r->mark;
+				r->state = S_URI_START;
+			}
+			else if(c < ' ' || c == 127)
+				return HTTP_BAD;
+			break;
+
+		case S_URI_START:
+			if(c == ' ')
+				break;
+			r->mark = i;
+			r->state = S_URI;
+			/* fall through */
+		case S_URI:
+			if(c == ' '){
+				r->uri.off = r->mark;
+				r->uri.len = i - r->mark;
+				r->state = S_VERSION_START;
+			}
+			else if(c < ' ' || c == 127)
+				return HTTP_BAD;
+			break;
+
+		case S_VERSION_START:
+			if(c == ' ')
+				break;
+			r->mark = i;
+			r->state = S_VERSION;
+			/* fall through */
+		case S_VERSION:
+			if(c == '\r' || c == '\n'){
+				if(end_line(r, buf, i) < 0) return HTTP_BAD;
+				r->state = (c == '\r') ? S_LINE_LF : S_HDR_START;
+			}
+			break;
+		case S_LINE_LF:
+		case S_HDR_LF:
+			if(c != '\n') return HTTP_BAD;
+			r->state = S_HDR_START;
+			break;
+
+		case S_HDR_START:
+			if(c == '\r'){
+				r->state = S_END_LF;
+				break;
+			}
+			if(c == '\n'){
+				r->state = S_DONE;
+				return r->pos = i+1;
+			}
+			/* folded lines and empty names aren't accepted */
+			if(c == ' ' || c == '\t' || c == ':' || r->nhdrs == HTTP_MAX_HEADERS)
+				return HTTP_BAD;
+			r->mark = i;
+			r->state = S_HDR_NAME;
+			break;
+		case S_HDR_NAME:
+			if(c == ':'){
+				r->hdrs[r->nhdrs].name.off = r->mark;
+				r->hdrs[r->nhdrs].name.len = i - r->mark;
+				r->state = S_HDR_OWS;
+			}
+			else if(c <= ' ' || c == 127)
+				return HTTP_BAD;
+			break;
+		case S_HDR_OWS:
+			if(c == ' ' || c == '\t')
+				break;
+			r->mark = i;
+			r->state = S_HDR_VALUE;
+			/* fall through */
+		case S_HDR_VALUE:
+			if(c == '\r' || c == '\n'){
+				end_header(r, buf, i);
+				r->state = (c == '\r') ? S_HDR_LF : S_HDR_START;
+			}
+			break;
+		case S_END_LF:
+			if(c != '\n') return HTTP_BAD;
+			r->state = S_DONE;
+			return r->pos = i+1;
+		}
+	}
+	r->pos = len;
+	return HTTP_AGAIN;
+}
+
+/*
+ * http_span_is - check whether span s of buf is str(case insensitive)
+ */
+int http_span_is(char *buf, http_span_t s, char *str)
+{
+	return (size_t)s.len == strlen(str) && !strncasecmp(buf + s.off, str, s.len);
+}
+
+/*
+ * end_line - the request line ends at buf[i] : record it and its version, and split the URI.
+ *            Return -1 if it has no URI or no version.
+ */
+static int end_line(http_req_t *r, char *buf, int i)
+{
+	int start, end;
+
+	if(i == r->mark)
+		return -1; // no version
+	r->line.off = r->method.off;
+	r->line.len = i - r->method.off;
+	r->minor = (i - r->mark == 8 && !strncmp(buf + r->mark, "HTTP/1.", 7) && buf[i-1] >= '0' && buf[i-1] <= '9') ?
+		buf[i-1] - '0' : 0;
+
+	/* "http://host:port/path" or just "/path" */
+	start = r->uri.off;
+	end = r->uri.off + r->uri.len;
+	if(r->uri.len >= 7 && !strncasecmp(buf + start, "http://", 7)){
+		start += 7;
+		for(i = start; i < end && buf[i] != '/' && buf[i] != '?'; i++)
+			;
+		split_host(r, buf, start, i);
+		start = i;
+	}
+	r->path.off = start;
+	r->path.len = end - start;
+	return 0;
+}
+
+/*
+ * end_header - the value of the header being parsed ends at buf[i] : record it without trailing white space.
+ *              A Host header gives the host and port if the URI didn't.
+ */
+static void end_header(http_req_t *r, char *buf, int i)
+{
+	http_hdr_t *h = &r->hdrs[r->nhdrs++];
+
+	while(i > r->mark && (buf[i-1] == ' ' || buf[i-1] == '\t'))
+		i--;
+	h->value.off = r->mark;
+	h->value.len = i - r->mark;
+	if(r->host.len == 0 && http_span_is(buf, h->name, "Host"))
+		split_host(r, buf, h->value.off, i);
+}
+
+/*
+ * split_host - record buf[start..end), a "host" or "host:port", as the host and port of the request.
+ *              An IPv6 address is in brackets, the host is what's inside them.
+ */
+static void split_host(http_req_t *r, char *buf, int start, int end)
+{
+	int i = start;
+
+	if(i < end && buf[i] == '['){
+		while(i < end && buf[i] != ']')
+			i++;
+		r->host.off = start+1;
+		r->host.len = i - start-1;
+		if(i < end) i++; // past ']'
+	}
+	else{
+		while(i < end && buf[i] != ':')
+			i++;
+		r->host.off = start;
+		r->host.len = i - start;
+	}
+	r->port.off = (i < end && buf[i] == ':') ? i+1 : end;
+	r->port.len = end - r->port.off;
+}
@@ -0,0 +1,45 @@
+/*
+ * http.h - incremental parser of HTTP request headers, shared by both engines of the proxy.
+ */
+#ifndef __HTTP_H__
+#define __HTTP_H__
+
+#define HTTP_MAX_HEADERS 64 /* max header lines of a request */
+
+/* Results of http_parse_req, a positive result is the length of the complete header */
+#define HTTP_AGAIN 0 /* the header isn't complete yet */
+#define HTTP_BAD -1  /* not a valid request header */
+
+/* A part of the buffer being parsed */
+typedef struct {
+	int off; // offset from the start of the buffer
+	int len;
+} http_span_t;
+
+/* One header line */
+typedef struct {
+	http_span_t name;
+	http_span_t value; // without the surrounding white space
+} http_hdr_t;
+
+/* A request header, as far as it is parsed */
+typedef struct {
+	int state; // parser state
+	int pos; // bytes of the buffer parsed so far
+	int mark; // where the part being parsed starts
+	http_span_t line; // the request line, without its line end
+	http_span_t method;
+	http_span_t uri;
+	http_span_t host; // from the absolute URI, or else from the Host header, len 0 if there's none
+	http_span_t port; // len 0 if there's none(80)
+	http_span_t path; // what follows the host in the URI, len 0 for "/"
+	int minor; // the request is HTTP/1.minor, 0 for any other version
+	int nhdrs; // header lines in hdrs
+	http_hdr_t hdrs[HTTP_MAX_HEADERS];
+} http_req_t;
+
+void http_req_init(http_req_t *r);
+int http_parse_req(http_req_t *r, char *buf, int len);
+int http_span_is(char *buf, http_span_t s, char *str);
+
+#endif /* __HTTP_H__ */
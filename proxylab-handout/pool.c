@@ -0,0 +1,161 @@
+/*
+ * pool.c - pool of idle persistent connections to end servers.
+ *
+ * After a response that leaves its connection open(HTTP/1.1 keep-alive, see relay_response in proxy.c),
+ * the connection is put back here instead of being closed, and the next request to the same end server
+ * (hostname and port) takes it again, which saves the TCP handshake. New connections are opened with the
+ * cached addresses of dns.c. Each end server has a host_t with a stack of at most POOL_MAX_IDLE idle
+ * connections, the most recently used on top. A connection idle for more than POOL_IDLE_SECS is closed, an
+ * end server closes idle connections on its own terms too, so pool_get also skips connections that already
+ * have something to read(end of file, most likely).
+ *
+ * One semaphore('mutex') protects the pool, it is only held to push or pop a descriptor.
+ */
+#include "csapp.h"
+#include "pool.h"
+#include "dns.h"
+
+/* Idle connections to one end server */
+typedef struct host {
+	char *key; // lower case "hostname:port"
+	int fds[POOL_MAX_IDLE]; // idle connections, fds[n-1] is the most recently used
+	time_t since[POOL_MAX_IDLE]; // when each one became idle
+	int n; // number of idle connections
+	struct host *next;
+} host_t;
+
+static host_t *hosts; // every end server seen so far
+static time_t last_sweep; // last time expired connections were closed
+static sem_t mutex; // protects everything above
+
+static host_t *find_host(char *hostname, char *port);
+static void sweep(time_t now);
+static int is_alive(int fd);
+
+/*
+ * pool_init - initialize the empty pool. Call before starting any thread.
+ */
+void pool_init(void)
+{
+	Sem_init(&mutex, 0, 1);
+}
+
+/*
+ * pool_get - return a connection to hostname:port, an idle one if there is any, a new one otherwise.
+ *            *reused tells which, a reused connection may still have been closed by the end server
+ *            in the meantime. Return -1 if the end server can't be reached.
+ */
+int pool_get(char *hostname, char *port, int *reused)
+{
+	host_t *h;
+	int fd;
+
+	P(&mutex);
+	sweep(time(NULL));
+	h = find_host(hostname, port);
+	while(h && h->n > 0){
+		fd = h->fds[--h->n];
+		V(&mutex);
+		if(is_alive(fd)){
+			*reused = 1;
+			return fd;
+		}
+		close(fd);
+		P(&mutex);
+	}
+	V(&mutex);
+
+	*reused = 0;
+	if((fd = dns_connect(hostname, port)) < 0) return -1;
+	return fd;
+}
+
+/*
+ * pool_put - keep fd, a connection to hostname:port at the end of a response, for the next request.
+ *            If the end server has POOL_MAX_IDLE idle connections already, close the oldest one.
+ */
+void pool_put(char *hostname, char *port, int fd)
+{
+	host_t *h;
+	char key[MAXLINE];
+	int i;
+	int victim = -1; // connection that didn't fit
+
+	P(&mutex);
+	if((h = find_host(hostname, port)) == NULL){
+		/* first connection kept for this end server */
+		snprintf(key, MAXLINE, "%s:%s", hostname, port);
+		for(i=0;key[i];i++)
+			key[i] = tolower((unsigned char)key[i]);
+		if((h = malloc(sizeof(host_t))) == NULL || (h->key = strdup(key)) == NULL){
+			V(&mutex);
+			free(h);
+			close(fd);
+			return;
+		}
+		h->n = 0;
+		h->next = hosts;
+		hosts = h;
+	}
+	if(h->n == POOL_MAX_IDLE){
+		victim = h->fds[0];
+		memmove(h->fds, h->fds + 1, (POOL_MAX_IDLE-1) * sizeof(int));
+		memmove(h->since, h->since + 1, (POOL_MAX_IDLE-1) * sizeof(time_t));
+		h->n--;
+	}
+	h->fds[h->n] = fd;
+	h->since[h->n] = time(NULL);
+	h->n++;
+	V(&mutex);
+
+	if(victim >= 0)
+		close(victim);
+}
+
+/*
+ * find_host - return the host_t of hostname:port, or NULL. The caller holds mutex.
+ */
+static host_t *find_host(char *hostname, char *port)
+{
+	host_t *h;
+	size_t len = strlen(hostname);
+
+	for(h = hosts; h != NULL; h = h->next)
+		if(!strncasecmp(h->key, hostname, len) && h->key[len] == ':' && !strcmp(h->key + len + 1, port))
+			return h;
+	return NULL;
+}
+
+/*
+ * sweep - close every connection idle for more than POOL_IDLE_SECS, at most once a second.
+ *         The caller holds mutex.
+ */
+static void sweep(time_t now)
+{
+	host_t *h;
+	int i, j;
+
+	if(now == last_sweep) return;
+	last_sweep = now;
+	for(h = hosts; h != NULL; h = h->next){
+		/* the oldest connections are at the bottom of the stack */
+		for(i=0;i<h->n && now - h->since[i] > POOL_IDLE_SECS;i++)
+			close(h->fds[i]);
+		for(j=i;j<h->n;j++){
+			h->fds[j-i] = h->fds[j];
+			h->since[j-i] = h->since[j];
+		}
+		h->n -= i;
+	}
+}
+
+/*
+ * is_alive - an idle connection must have nothing to read : end of file means the end server closed it,
+ *            and data that no request asked for means it can't be trusted either.
+ */
+static int is_alive(int fd)
+{
+	char c;
+
+	return recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
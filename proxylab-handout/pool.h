@@ -0,0 +1,14 @@
+/*
+ * pool.h - idle persistent connections to end servers, shared by the worker threads of the proxy.
+ */
+#ifndef __POOL_H__
+#define __POOL_H__
+
+#define POOL_MAX_IDLE 8    /* max idle connections kept per end server */
+#define POOL_IDLE_SECS 30  /* idle connections older than this are closed */
+
+void pool_init(void);
+int pool_get(char *hostname, char *port, int *reused);
+void pool_put(char *hostname, char *port, int fd);
+
+#endif /* __POOL_H__ */
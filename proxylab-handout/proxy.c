@@ -3,164 +3,673 @@
  * 
  * Writer : cs20150326 Park Si Hwan
  *
+ * The proxy is prethreaded : main only accepts connections and puts the connected descriptors into
+ * a bounded buffer(sbuf), a fixed pool of worker threads takes them out and serves one connection at a time.
+ * The pool size is set with -t (default NTHREADS). Since every connection shares one process, errors on
+ * a connection only end that connection, and SIGPIPE is ignored so a client closing early can't kill the proxy.
+ *
+ * Responses to GET requests are kept in the shared object cache of cache.c(up to MAX_OBJECT_SIZE bytes each),
+ * a request for a cached object is answered from memory without connecting to the end server.
+ *
+ * Worker threads talk HTTP/1.1 with keep-alive to end servers. relay_response finds where each response ends
+ * (Content-Length, chunked encoding, or the end server closing), and a connection the end server keeps open goes
+ * back to the pool of pool.c for the next request to the same end server.
+ *
+ * Headers are read line by line and sent to the client with one write, bodies in blocks of up to BODY_BLOCK bytes
+ * (one read and one write each). Client sockets are TCP_NODELAY : on a kept-alive connection, Nagle's algorithm
+ * would hold back the small last write of a response until the client's delayed ACK.
+ * A response body that won't be cached(not a GET, or too big for MAX_OBJECT_SIZE) is moved from end server
+ * to client with splice(2) through a pipe(splice.c), without copying it to user memory.
+ *
+ * Client connections are persistent as well : doit serves requests of a connection one after another, so
+ * pipelined requests are answered in order, until the client asks to close, the response can't be framed for it,
+ * or it stays idle for CLIENT_IDLE_SECS. Connection headers are hop-by-hop, the proxy drops the ones it receives
+ * and sends its own, and answers every client as HTTP/1.1(chunked responses are de-chunked for HTTP/1.0 clients).
+ *
+ * With -e epoll the proxy runs the event driven engine of epoll.c instead : one thread, nonblocking sockets,
+ * and a small state machine per connection, so a slow end server holds no thread.
+ *
  */
 #include <stdio.h>
+#include <sys/uio.h>
+#include <netinet/tcp.h>
 #include "csapp.h"
+#include "sbuf.h"
+#include "proxy.h"
+#include "cache.h"
+#include "pool.h"
+#include "dns.h"
+#include "splice.h"
+
+#define NTHREADS 16 /* default number of worker threads */
+#define SBUFSIZE 64 /* max number of accepted connections waiting for a worker */
+#define CLIENT_IDLE_SECS 5 /* a worker closes a client connection idle that long between requests */
+#define BODY_BLOCK 65536 /* max bytes of a body moved by one read and one write */
 
-/* Recommended max cache and object sizes */
-#define MAX_CACHE_SIZE 1049000
-#define MAX_OBJECT_SIZE 102400
+/* Results of relay_response */
+#define RESP_NONE -2  /* the end server sent nothing(e.g. it had closed a pooled connection) */
+#define RESP_ERROR -1 /* the response broke off, or the client went away */
+#define RESP_CLOSE 0  /* complete response, the connection can't be reused */
+#define RESP_KEEP 1   /* complete response, the end server keeps the connection open */
 
+void *thread(void *vargp);
 void doit(int fd);
-void parse_req(char *uri, char *port, char *hostname, char *request);
-int parse_uri(char *uri, char *filename, char *cgiargs);
+static int serve_request(rio_t *crp, int fd);
+static int read_request(rio_t *rp, char *req, http_req_t *r);
+static int send_cached(int fd, char *obj, int size, int keep);
+static int relay_response(rio_t *rp, int fd, int head, int dechunk, int *ckeep, char *obj, int *objsize);
+static int copy_body(rio_t *rp, int fd, long n, char *obj, int *objsize);
+static int splice_body(rio_t *rp, int fd, long n);
+static ssize_t read_block(rio_t *rp, char *buf, size_t n);
+static int forward(int fd, char *buf, int n, char *obj, int *objsize);
+static int add_header(int fd, char *hdr, int *len, char *buf, int n, char *obj, int *objsize);
+static int writev_all(int fd, struct iovec *iov, int iovcnt);
+static int has_token(char *value, int len, char *token);
+static void send_error(int fd, char *status);
+static void usage(char *prog);
 
 /* You won't lose style points for including this long line in your code */
 static const char *user_agent_hdr = "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:10.0.3) Gecko/20120305 Firefox/10.0.3\r\n";
 
+static sbuf_t sbuf; // connected descriptors waiting for a worker thread
+
 int main(int argc, char **argv)
 {
-    typedef struct sockaddr SA;
 	int listenfd,connfd;
+	int i,c;
+	int nthreads = NTHREADS; // size of the worker pool
+	int use_epoll = 0; // serve with the epoll engine instead of the pool
 	char hostname[MAXLINE],port[MAXLINE];
 	struct sockaddr_storage clientaddr;
 	socklen_t clientlen;
-	pid_t pid; // pid for fork a new child process
+	pthread_t tid;
 	
-	/* If argc != 2, print error message and exit */
-	if(argc != 2){
-		fprintf(stderr,"usage: %s <port>\n",argv[0]);
-		exit(1);
+	/* Parse the options, if the arguments are wrong print usage and exit */
+	while((c = getopt(argc, argv, "t:e:")) != -1){
+		if(c == 't' && (nthreads = atoi(optarg)) > 0)
+			continue;
+		if(c == 'e' && (!strcmp(optarg, "threads") || !strcmp(optarg, "epoll"))){
+			use_epoll = !strcmp(optarg, "epoll");
+			continue;
+		}
+		usage(argv[0]);
 	}
+	if(optind != argc-1)
+		usage(argv[0]);
+
+	/* writing to a closed connection must fail with EPIPE instead of killing the proxy */
+	Signal(SIGPIPE, SIG_IGN);
 	
-	listenfd = Open_listenfd(argv[1]);
+	listenfd = Open_listenfd(argv[optind]);
+	cache_init();
+	pool_init();
+	dns_init();
+	if(use_epoll)
+		epoll_serve(listenfd);
+
+	/* start the worker pool */
+	sbuf_init(&sbuf, SBUFSIZE);
+	for(i=0;i<nthreads;i++)
+		Pthread_create(&tid, NULL, thread, NULL);
+
 	while(1){
 		clientlen = sizeof(clientaddr);
-		connfd = Accept(listenfd, (SA *)&clientaddr, &clientlen);
+		if((connfd = accept(listenfd, (SA *)&clientaddr, &clientlen)) < 0)
+			continue; // e.g. the client gave up before we accepted it
 		
-		/* fork a new child for concurrency */
-		if((pid = fork())==0){
-			Close(listenfd);
-			Getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE,0);
+		if(getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE,0) == 0)
 			printf("Accepted connection from (%s, %s)\n",hostname, port);
-			doit(connfd);
-			Close(connfd);
-			exit(0);
-		}
-		Close(connfd); // close connfd to prevent memory leak
+		sbuf_insert(&sbuf, connfd); // blocks while SBUFSIZE connections are already waiting
+	}
+}
+
+/*
+ * thread - worker thread routine. Take a connected descriptor from sbuf, serve it, close it, and repeat.
+ */
+void *thread(void *vargp)
+{
+	int connfd, one = 1;
+	struct timeval idle = {CLIENT_IDLE_SECS, 0};
+
+	Pthread_detach(pthread_self());
+	while(1){
+		connfd = sbuf_remove(&sbuf);
+		/* an idle keep-alive client must not hold the worker forever : reads fail after CLIENT_IDLE_SECS */
+		setsockopt(connfd, SOL_SOCKET, SO_RCVTIMEO, &idle, sizeof(idle));
+		setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		doit(connfd);
+		Close(connfd);
 	}
+	return NULL;
 }
 
 /*
  * doit - doit is main routine for proxy's role.
- *        read client's request, parsing them and connect with end server, send the parsed
- *        request to end server, read the end server's response, finally send the end server's
- *        respones to client.
+ *        serve the requests of client connection fd in order until it has to be closed. The rio buffer
+ *        lives across requests, so pipelined requests already read with the previous one aren't lost.
+ *        It runs in a worker thread, so errors only abandon this connection(the caller closes fd).
  */
 void doit(int fd)
 {
-	char buf[MAXLINE], method[MAXLINE], version[MAXLINE], uri[MAXLINE];
-	char port[MAXLINE], hostname[MAXLINE], request[MAXLINE], fwreq[MAXLINE];
 	rio_t rio;
-	int clientfd,num;
-	
-	/* Read the request from client */
-	Rio_readinitb(&rio, fd);
-	if(!Rio_readlineb(&rio, buf, MAXLINE)) return;
-	printf("%s", buf);
-
-	/* Parse the HTTP request */
-	sscanf(buf,"%s %s %s", method, uri, version);
-	parse_req(uri,port,hostname,request);
-	
-	/* Connect to end server */
-	clientfd = Open_clientfd(hostname,port);
-	
-	/* Initialize the rio connect to clientfd and fwreq(fowarding request) */
-	Rio_readinitb(&rio, clientfd);
-	memset(fwreq,0,MAXLINE);
-
-	/* Make HTTP request header */
-	strcat(fwreq, method);
-	strcat(fwreq, " ");
-	strcat(fwreq, request);
-	strcat(fwreq, " ");
-	strcat(fwreq, "HTTP/1.0\r\n");
-	sprintf(fwreq, "%sHost: %s\r\n",fwreq,hostname);
-	strcat(fwreq, user_agent_hdr);
-	strcat(fwreq, "Connection: close\r\n");
-	strcat(fwreq, "Proxy-Connection: close\r\n");
-	strcat(fwreq, "\r\n");
+
+	rio_readinitb(&rio, fd);
+	while(serve_request(&rio, fd))
+		;
+}
+
+/*
+ * serve_request - read one request from client(crp, fd), parsing it and connect with end server, send the
+ *                 parsed request to end server, read the end server's response, finally send the end server's
+ *                 response to client. Cached objects are sent from memory.
+ *                 Return 1 if the client connection stays open for the next request, 0 if it must be closed.
+ */
+static int serve_request(rio_t *crp, int fd)
+{
+	char req[MAXBUF], port[MAXLINE], hostname[MAXLINE], fwreq[MAXBUF];
+	char key[MAXLINE], obj[MAX_OBJECT_SIZE];
+	char *method, *request, *value;
+	http_req_t r;
+	http_hdr_t *h;
+	rio_t rio;
+	int serverfd,num,rc,i;
+	int ckeep; // keep the client connection open after this request
+	int expect = 0; // the client waits for 100 Continue before sending the body
+	long bodylen = 0; // Content-Length of the request body
+	int reused; // serverfd came from the pool
+	int cacheable; // a GET request, its response may be cached
+	int objsize; // bytes of the response copied to obj, -1 once it doesn't fit
 	
-	/* Send the HTTP request to end server */
-	Rio_writen(clientfd, fwreq, (int)strlen(fwreq)+1);
+	/* Read and parse the request header */
+	if(read_request(crp, req, &r) < 0) return 0;
+	printf("%.*s\n", r.line.len, req + r.line.off);
+	if(req_target(req, &r, hostname, port) < 0) return 0;
+	method = req + r.method.off;
+	request = req + r.path.off;
 
-	/* Read end server's response and send to client */
-	while((num = Rio_readlineb(&rio, buf, MAXLINE))>0){
-		Rio_writen(fd,buf,num);
-		Fputs(buf, stdout);
+	/* HTTP/1.1 clients keep the connection by default, HTTP/1.0 ones close it. The other headers the proxy
+	   cares about frame the request body */
+	ckeep = (r.minor >= 1);
+	for(i = 0, h = r.hdrs; i < r.nhdrs; i++, h++){
+		value = req + h->value.off;
+		if(http_span_is(req, h->name, "Connection") || http_span_is(req, h->name, "Proxy-Connection")){
+			if(has_token(value, h->value.len, "close")) ckeep = 0;
+			else if(has_token(value, h->value.len, "keep-alive")) ckeep = 1;
+		}
+		else if(http_span_is(req, h->name, "Expect"))
+			expect = has_token(value, h->value.len, "100-continue");
+		else if(http_span_is(req, h->name, "Transfer-Encoding")){
+			send_error(fd, "411 Length Required"); // a chunked request body can't be framed here
+			return 0;
+		}
+		else if(http_span_is(req, h->name, "Content-Length") && (bodylen = atol(value)) < 0){
+			send_error(fd, "400 Bad Request");
+			return 0;
+		}
 	}
-	Close(clientfd);
+
+	/* Serve a cached object straight from memory */
+	if((cacheable = !strcasecmp(method, "GET") && bodylen == 0)){
+		cache_key(key, hostname, port, request);
+		if((num = cache_find(key, obj)) >= 0)
+			return send_cached(fd, obj, num, ckeep);
+	}
+	
+	/* Make fwreq(fowarding request) */
+	if((num = make_req(fwreq, MAXBUF, req, &r, hostname, 1)) >= MAXBUF-1)
+		return 0; // it did not fit
+	if(bodylen > 0 && expect && r.minor >= 1 && rio_writen(fd, "HTTP/1.1 100 Continue\r\n\r\n", 25) != 25)
+		return 0;
+
+	/* Send it to end server, on a pooled connection if there's one, and relay the response to client.
+	   If the end server closed the pooled connection meanwhile, nothing comes back : try the next one.
+	   A request body can't be sent twice, so that request always gets a new connection */
+	do{
+		reused = 0;
+		if((serverfd = bodylen ? dns_connect(hostname, port) : pool_get(hostname, port, &reused)) < 0)
+			return 0;
+		rio_readinitb(&rio, serverfd);
+		objsize = 0;
+		rc = RESP_NONE;
+		if(rio_writen(serverfd, fwreq, num) == num && copy_body(crp, serverfd, bodylen, NULL, NULL) == 0)
+			rc = relay_response(&rio, fd, !strcasecmp(method, "HEAD"), r.minor < 1, &ckeep, cacheable ? obj : NULL, &objsize);
+		if(rc != RESP_KEEP)
+			Close(serverfd);
+	}while(rc == RESP_NONE && reused);
+
+	if(rc == RESP_KEEP)
+		pool_put(hostname, port, serverfd);
+
+	/* cache the whole response, if the end server finished it and it fits */
+	if(cacheable && rc >= RESP_CLOSE && objsize > 0)
+		cache_insert(key, obj, objsize);
+	return rc >= RESP_CLOSE && ckeep;
 }
 
 /*
- * parse_req - parsing the HTTP request from client to make new HTTP request for end server
- *             and find hostname and port for connect with end server
+ * read_request - read the request header from client(rp) to req(MAXBUF bytes), parsing it into r as it arrives.
+ *                The bytes rp has buffered are taken first, otherwise the socket is read straight into req.
+ *                What follows the header(a body, or the next pipelined request) is left in rp.
+ *                Return the length of the header, or -1 if the client closed, timed out or sent a bad request.
  */
-void parse_req(char *uri, char *port, char *hostname, char *request)
+static int read_request(rio_t *rp, char *req, http_req_t *r)
 {
+	int len = 0; // bytes in req
+	int n, rc, extra;
+	int buffered; // the last bytes came from the rio buffer
 
-	int i,j,si; // string iterators
-	int cnt1 = 0; // count the number of occurrences of '/'
-	int cnt2 = 0; // count the number of occurrences of ':'
-	
-	/* Initialize the port, hostname and request string */
-	memset(port,0,MAXLINE);
-	memset(hostname,0,MAXLINE);
-	memset(request,0,MAXLINE);
-
-	for(i=0;i<strlen(uri);i++){
-		/* find '/' */
-		if(uri[i]=='/'){
-			cnt1++;
-			/* cnt1 == 2 means next few characters are hostname */ 
-			if(cnt1==2){
-				j = 0;
-				si = i+1;
-				while(uri[si]!=':'){
-					hostname[j++] = uri[si++];
-				}
+	http_req_init(r);
+	while(1){
+		if(len == MAXBUF)
+			return -1; // the header doesn't fit
+		if((buffered = (rp->rio_cnt > 0))){
+			n = (rp->rio_cnt < MAXBUF - len) ? rp->rio_cnt : MAXBUF - len;
+			memcpy(req + len, rp->rio_bufptr, n);
+			rp->rio_bufptr += n;
+			rp->rio_cnt -= n;
+		}
+		else if((n = read(rp->rio_fd, req + len, MAXBUF - len)) <= 0){
+			if(n < 0 && errno == EINTR) continue;
+			return -1;
+		}
+		len += n;
+		if((rc = http_parse_req(r, req, len)) == HTTP_BAD)
+			return -1;
+		if(rc == HTTP_AGAIN)
+			continue;
+
+		/* give back the bytes that follow the header, they all came with the last n */
+		if((extra = len - rc) > 0){
+			if(buffered){
+				rp->rio_bufptr -= extra;
+				rp->rio_cnt += extra;
 			}
-			/* cnt1 == 3 means next few characters are request file name */
-			else if(cnt1 == 3){
-				j=0;
-				si = i;
-				while(si<strlen(uri)){
-					request[j] = uri[si];
-					j++;
-					si++;
-				}
+			else{
+				memcpy(rp->rio_buf, req + rc, extra);
+				rp->rio_bufptr = rp->rio_buf;
+				rp->rio_cnt = extra;
 			}
 		}
-		/* find ':' */
-		if(uri[i]==':'){
-			cnt2++;
-			/* cnt2 == 2 means next few characters are port number */
-			if(cnt2==2){
-				j = 0;
-				si = i+1;
-				while(uri[si]!='/'){
-					port[j++] = uri[si++];
-				}
-			}
+		return rc;
+	}
+}
+
+/*
+ * send_cached - send the cached object obj(size bytes) to client(fd) with its own connection header, in one writev.
+ *               Cached objects are never chunked, so the body length is known : if the end server didn't send
+ *               Content-Length, add it. Return keep, or 0 if the client went away.
+ */
+static int send_cached(int fd, char *obj, int size, int keep)
+{
+	char hdr[MAXLINE];
+	char *p, *eol, *end = obj + size;
+	int n, haslen = 0;
+	struct iovec iov[3];
+
+	/* find the blank line at the end of the headers */
+	for(p = obj; ; p = eol + 1){
+		if((eol = memchr(p, '\n', end - p)) == NULL)
+			return 0; // no blank line, can't happen for an object relay_response finished
+		if(eol == p || (eol == p + 1 && *p == '\r'))
+			break;
+		if(!strncasecmp(p, "Content-Length:", 15))
+			haslen = 1;
+	}
+
+	n = 0;
+	if(!haslen)
+		n = snprintf(hdr, MAXLINE, "Content-Length: %ld\r\n", (long)(end - eol - 1));
+	n += snprintf(hdr + n, MAXLINE - n, "Connection: %s\r\n", keep ? "keep-alive" : "close");
+	iov[0].iov_base = obj; // the headers of the object
+	iov[0].iov_len = p - obj;
+	iov[1].iov_base = hdr;
+	iov[1].iov_len = n;
+	iov[2].iov_base = p; // the blank line and the body
+	iov[2].iov_len = end - p;
+	if(writev_all(fd, iov, 3) < 0)
+		return 0;
+	return keep;
+}
+
+/*
+ * relay_response - read one response from end server(rp) and send it to client(fd), keeping a copy in obj
+ *                  (MAX_OBJECT_SIZE bytes, NULL for no copy) while it fits, *objsize is -1 once it doesn't.
+ *                  A body without chunked encoding that isn't copied is spliced.
+ *                  The body is framed by the headers : Content-Length or chunked encoding, otherwise it lasts
+ *                  until the end server closes. A response to HEAD(head is set), 204 and 304 have no body, and
+ *                  interim 1xx responses are dropped.
+ *                  The client gets the response as HTTP/1.1 with the proxy's own Connection header, the status
+ *                  line and the headers in one write(see add_header). *ckeep says
+ *                  whether the client wants to keep its connection, it is cleared if the client can't tell where
+ *                  the response ends. With dechunk(an HTTP/1.0 client) chunked bodies are sent as plain data.
+ *                  The copy in obj is always de-chunked and has no connection headers.
+ *                  Return one of the RESP_ results.
+ */
+static int relay_response(rio_t *rp, int fd, int head, int dechunk, int *ckeep, char *obj, int *objsize)
+{
+	char buf[MAXLINE], block[BODY_BLOCK], hdr[MAXBUF];
+	char *conn;
+	int n, minor, status;
+	int hn = 0; // bytes of the header in hdr, not sent yet
+	int chunked = 0; // Transfer-Encoding: chunked
+	int keep; // the end server keeps the connection open after this response
+	int cfd = dechunk ? -1 : fd; // where the chunked framing goes, nowhere if it is de-chunked
+	long length = -1; // Content-Length, -1 if there's none
+
+	/* Status line : HTTP/1.1 keeps the connection open unless it says otherwise, HTTP/1.0 closes it */
+	while(1){
+		if((n = rio_readlineb(rp, buf, MAXLINE)) <= 0) return RESP_NONE;
+		if(sscanf(buf, "HTTP/1.%d %d", &minor, &status) != 2) return RESP_ERROR;
+		if(status/100 != 1) break;
+
+		/* an interim response(e.g. 100 Continue), skip its headers and wait for the real one */
+		do{
+			if(rio_readlineb(rp, buf, MAXLINE) <= 0) return RESP_ERROR;
+		}while(strcmp(buf, "\r\n") && strcmp(buf, "\n"));
+	}
+	keep = (minor >= 1);
+	buf[7] = '1';
+	if(add_header(fd, hdr, &hn, buf, n, obj, objsize) < 0) return RESP_ERROR;
+
+	/* Headers, up to the blank line. Connection headers are only for the proxy */
+	while(1){
+		if((n = rio_readlineb(rp, buf, MAXLINE)) <= 0)
+			return RESP_ERROR;
+		if(!strcmp(buf, "\r\n") || !strcmp(buf, "\n"))
+			break;
+		if(!strncasecmp(buf, "Connection:", 11)){
+			if(has_token(buf + 11, n - 11, "close")) keep = 0;
+			else if(has_token(buf + 11, n - 11, "keep-alive")) keep = 1;
+			continue;
+		}
+		if(!strncasecmp(buf, "Keep-Alive:", 11) || !strncasecmp(buf, "Proxy-Connection:", 17))
+			continue;
+		if(!strncasecmp(buf, "Transfer-Encoding:", 18)){
+			chunked = has_token(buf + 18, n - 18, "chunked");
+			if(add_header(chunked ? cfd : fd, hdr, &hn, buf, n, NULL, NULL) < 0)
+				return RESP_ERROR;
+			continue;
 		}
+		if(!strncasecmp(buf, "Content-Length:", 15))
+			length = atol(buf + 15);
+		if(add_header(fd, hdr, &hn, buf, n, obj, objsize) < 0)
+			return RESP_ERROR;
+	}
+
+	/* The client connection stays open only if the client can tell where the body ends */
+	if(!(head || status == 204 || status == 304 || (chunked ? !dechunk : length >= 0)))
+		*ckeep = 0;
+	if(chunked && length >= 0)
+		*objsize = -1; // the copy would keep a Content-Length that doesn't match
+	conn = *ckeep ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+	if(add_header(fd, hdr, &hn, conn, strlen(conn), NULL, NULL) < 0 || add_header(fd, hdr, &hn, buf, n, obj, objsize) < 0
+		|| rio_writen(fd, hdr, hn) != hn)
+		return RESP_ERROR;
 
+	/* Body */
+	if(head || status == 204 || status == 304){
+		/* CASE1 : no body */
+	}
+	else if(chunked){
+		/* CASE2 : chunks, each one is a size line, data and CRLF. The last has size 0 and trailers follow.
+		   Only the data goes to obj, and to client if it is de-chunked */
+		while(1){
+			if((n = rio_readlineb(rp, buf, MAXLINE)) <= 0 || forward(cfd, buf, n, NULL, NULL) < 0)
+				return RESP_ERROR;
+			if((length = strtol(buf, NULL, 16)) <= 0)
+				break;
+			if(copy_body(rp, fd, length, obj, objsize) < 0 || copy_body(rp, cfd, 2, NULL, NULL) < 0)
+				return RESP_ERROR;
+		}
+		if(length < 0) return RESP_ERROR;
+		do{
+			if((n = rio_readlineb(rp, buf, MAXLINE)) <= 0 || forward(cfd, buf, n, NULL, NULL) < 0)
+				return RESP_ERROR;
+		}while(strcmp(buf, "\r\n") && strcmp(buf, "\n"));
+	}
+	else if(length >= 0){
+		/* CASE3 : Content-Length bytes, spliced if they won't fit in obj */
+		if(obj != NULL && *objsize >= 0 && *objsize + length <= MAX_OBJECT_SIZE){
+			if(copy_body(rp, fd, length, obj, objsize) < 0)
+				return RESP_ERROR;
+		}
+		else{
+			if(obj != NULL) *objsize = -1;
+			if(splice_body(rp, fd, length) < 0)
+				return RESP_ERROR;
+		}
+	}
+	else{
+		/* CASE4 : until the end server closes, read while it may still fit in obj and splice the rest */
+		while(obj != NULL && *objsize >= 0){
+			if((n = read_block(rp, block, BODY_BLOCK)) <= 0)
+				return (n == 0) ? RESP_CLOSE : RESP_ERROR;
+			if(forward(fd, block, n, obj, objsize) < 0)
+				return RESP_ERROR;
+		}
+		return (splice_body(rp, fd, -1) < 0) ? RESP_ERROR : RESP_CLOSE;
 	}
+	return keep ? RESP_KEEP : RESP_CLOSE;
+}
+
+/*
+ * copy_body - relay exactly n bytes of a body from rp to fd, see forward
+ */
+static int copy_body(rio_t *rp, int fd, long n, char *obj, int *objsize)
+{
+	char buf[BODY_BLOCK];
+	int num;
 
-	/* If there's no port, set port to 80 */
-	if(!(*port)){
-		strcpy(port,"80");
+	while(n > 0){
+		if((num = read_block(rp, buf, (n < BODY_BLOCK) ? n : BODY_BLOCK)) <= 0)
+			return -1; // the end server closed before the end of the body
+		if(forward(fd, buf, num, obj, objsize) < 0)
+			return -1;
+		n -= num;
 	}
-	
-	return;
+	return 0;
+}
+
+/*
+ * read_block - read up to n bytes of a body from rp to buf : the bytes rp has buffered already, or else one read
+ *              straight from the socket, so a body doesn't go through the rio buffer MAXBUF bytes at a time.
+ *              Return the number of bytes read, 0 on end of file, -1 on error.
+ */
+static ssize_t read_block(rio_t *rp, char *buf, size_t n)
+{
+	ssize_t num;
+
+	if(rp->rio_cnt > 0)
+		return rio_readnb(rp, buf, (n < (size_t)rp->rio_cnt) ? n : rp->rio_cnt);
+	while((num = read(rp->rio_fd, buf, n)) < 0)
+		if(errno != EINTR) return -1;
+	return num;
+}
+
+/*
+ * splice_body - relay n bytes of a body(until end of file if n < 0) from rp to fd with splice_relay.
+ *               The bytes rp has buffered already are written first.
+ */
+static int splice_body(rio_t *rp, int fd, long n)
+{
+	long num = rp->rio_cnt;
+
+	if(n >= 0 && num > n)
+		num = n;
+	if(num > 0){
+		if(rio_writen(fd, rp->rio_bufptr, num) != num)
+			return -1;
+		rp->rio_bufptr += num;
+		rp->rio_cnt -= num;
+		if(n >= 0) n -= num;
+	}
+	if(n == 0)
+		return 0;
+	num = splice_relay(rp->rio_fd, fd, n);
+	return (num < 0 || (n >= 0 && num != n)) ? -1 : 0;
+}
+
+/*
+ * forward - send n bytes to fd and keep a copy in obj while it fits. Either is skipped if fd is -1 or obj NULL.
+ */
+static int forward(int fd, char *buf, int n, char *obj, int *objsize)
+{
+	if(fd >= 0 && rio_writen(fd, buf, n) != n)
+		return -1;
+	if(obj == NULL)
+		return 0;
+	if(*objsize >= 0 && *objsize + n <= MAX_OBJECT_SIZE){
+		memcpy(obj + *objsize, buf, n);
+		*objsize += n;
+	}
+	else *objsize = -1;
+	return 0;
+}
+
+/*
+ * add_header - append a header line(n bytes) for fd to hdr(*len bytes so far) instead of writing it, so the whole
+ *              header goes out in one write, and keep a copy in obj like forward. hdr is written early only if
+ *              the header grows past MAXBUF. The line is dropped if fd is -1.
+ */
+static int add_header(int fd, char *hdr, int *len, char *buf, int n, char *obj, int *objsize)
+{
+	if(fd >= 0){
+		if(*len + n > MAXBUF){
+			if(rio_writen(fd, hdr, *len) != *len)
+				return -1;
+			*len = 0;
+		}
+		memcpy(hdr + *len, buf, n);
+		*len += n;
+	}
+	return forward(-1, buf, n, obj, objsize);
+}
+
+/*
+ * writev_all - writev the iovcnt buffers of iov to fd, going on after short writes like rio_writen.
+ *              iov is modified. Return 0, or -1 on error.
+ */
+static int writev_all(int fd, struct iovec *iov, int iovcnt)
+{
+	ssize_t n;
+
+	while(iovcnt > 0){
+		if((n = writev(fd, iov, iovcnt)) < 0){
+			if(errno == EINTR) continue;
+			return -1;
+		}
+		for(; iovcnt > 0 && (size_t)n >= iov->iov_len; iov++, iovcnt--)
+			n -= iov->iov_len;
+		if(iovcnt > 0){
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+	return 0;
+}
+
+/*
+ * send_error - send the error_resp of status to client(fd) before its connection is closed. The client may
+ *              still be sending a request body, and closing a socket with unread data resets the connection,
+ *              which can destroy the response before the client reads it : stop writing and read until the
+ *              client closes(or the idle timeout) first.
+ */
+static void send_error(int fd, char *status)
+{
+	char buf[MAXLINE];
+	int n = error_resp(buf, MAXLINE, status);
+
+	if(rio_writen(fd, buf, n) != n || shutdown(fd, SHUT_WR) < 0)
+		return;
+	while((n = read(fd, buf, MAXLINE)) > 0 || (n < 0 && errno == EINTR))
+		;
+}
+
+/*
+ * has_token - check whether the comma separated header value(len bytes) has a list element equal to
+ *             token(case insensitive). Each element is trimmed of spaces and tabs(and the CRLF of a raw
+ *             header line), so "keep-alive" doesn't match "x-keep-alive" and "close" doesn't match "closed".
+ */
+static int has_token(char *value, int len, char *token)
+{
+	int start, end, n = strlen(token);
+	char *p = value, *stop = value + len, *comma;
+
+	while(p < stop){
+		if((comma = memchr(p, ',', stop - p)) == NULL) comma = stop;
+		for(start = 0; p + start < comma && (p[start] == ' ' || p[start] == '\t'); start++)
+			;
+		for(end = comma - p; end > start && isspace((unsigned char)p[end - 1]); end--) // also the CRLF
+			;
+		if(end - start == n && !strncasecmp(p + start, token, n)) return 1;
+		p = comma + 1;
+	}
+	return 0;
+}
+
+/*
+ * make_req - make the HTTP request header for end server in fwreq(size bytes) and return its length, from the
+ *            request r parsed in buf. The client's headers are passed on as they are, except the ones the proxy
+ *            makes itself(Host, User-Agent and the connection headers) and Expect.
+ *            With keepalive it is an HTTP/1.1 request asking to keep the connection open, otherwise HTTP/1.0 and close.
+ */
+int make_req(char *fwreq, size_t size, char *buf, http_req_t *r, char *hostname, int keepalive)
+{
+	http_hdr_t *h;
+	size_t len;
+	int i;
+
+	len = snprintf(fwreq, size, "%.*s %s%.*s HTTP/1.%d\r\nHost: %s\r\n%s%s",
+		r->method.len, buf + r->method.off, (r->path.len && buf[r->path.off] == '/') ? "" : "/",
+		r->path.len, buf + r->path.off, keepalive ? 1 : 0, hostname, user_agent_hdr,
+		keepalive ? "Connection: keep-alive\r\n" : "Connection: close\r\nProxy-Connection: close\r\n");
+	for(i = 0, h = r->hdrs; i < r->nhdrs && len < size; i++, h++){
+		if(http_span_is(buf, h->name, "Host") || http_span_is(buf, h->name, "User-Agent") ||
+		   http_span_is(buf, h->name, "Connection") || http_span_is(buf, h->name, "Proxy-Connection") ||
+		   http_span_is(buf, h->name, "Keep-Alive") || http_span_is(buf, h->name, "Expect"))
+			continue;
+		len += snprintf(fwreq + len, size - len, "%.*s: %.*s\r\n",
+			h->name.len, buf + h->name.off, h->value.len, buf + h->value.off);
+	}
+	if(len < size)
+		len += snprintf(fwreq + len, size - len, "\r\n");
+	return (len < size) ? (int)len : (int)size-1; // truncated if it did not fit
+}
+
+/*
+ * error_resp - make the response to a request the proxy won't serve in buf(size bytes) : status("code reason")
+ *              with a short text body, and the connection closes after it. Return its length.
+ */
+int error_resp(char *buf, size_t size, char *status)
+{
+	return snprintf(buf, size, "HTTP/1.1 %s\r\nContent-Type: text/plain\r\nContent-Length: %d\r\n"
+		"Connection: close\r\n\r\n%s\n", status, (int)strlen(status) + 1, status);
+}
+
+/*
+ * req_target - copy the end server's hostname and port(80 if the request names none) of the request r parsed
+ *              in buf to hostname and port(MAXLINE bytes each), and end the method and path in buf with '\0'
+ *              (a space follows both in the request line). Return -1 if the request names no end server.
+ */
+int req_target(char *buf, http_req_t *r, char *hostname, char *port)
+{
+	if(r->host.len == 0 || r->host.len >= MAXLINE || r->port.len >= MAXLINE)
+		return -1;
+	memcpy(hostname, buf + r->host.off, r->host.len);
+	hostname[r->host.len] = '\0';
+	if(r->port.len > 0){
+		memcpy(port, buf + r->port.off, r->port.len);
+		port[r->port.len] = '\0';
+	}
+	else
+		strcpy(port, "80");
+	buf[r->method.off + r->method.len] = '\0';
+	buf[r->path.off + r->path.len] = '\0';
+	return 0;
+}
+
+static void usage(char *prog)
+{
+	fprintf(stderr,"usage: %s [-t <threads>] [-e threads|epoll] <port>\n",prog);
+	exit(1);
 }
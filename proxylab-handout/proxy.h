@@ -0,0 +1,18 @@
+/*
+ * proxy.h - shared between proxy.c and the engines that serve the connections.
+ */
+#ifndef __PROXY_H__
+#define __PROXY_H__
+
+#include "csapp.h"
+#include "http.h"
+
+/* Request handling (proxy.c) */
+int req_target(char *buf, http_req_t *r, char *hostname, char *port);
+int make_req(char *fwreq, size_t size, char *buf, http_req_t *r, char *hostname, int keepalive);
+int error_resp(char *buf, size_t size, char *status);
+
+/* Event driven engine (epoll.c) : serve every connection of listenfd from one thread, never returns */
+void epoll_serve(int listenfd);
+
+#endif /* __PROXY_H__ */
@@ -0,0 +1,74 @@
+/*
+ * splice.c - zero copy relay between two sockets.
+ *
+ * splice_relay moves bytes from one socket to another through a pipe with splice(2), so they never get
+ * copied to a user buffer. Each thread has its own pipe, made on its first relay and kept for the next ones.
+ * A relay that fails may leave bytes in the pipe, so the pipe is closed then and a new one made next time.
+ *
+ * This file doesn't include csapp.h : splice needs _GNU_SOURCE, and with it glibc declares a gai_error
+ * that conflicts with the one of csapp.h.
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include "splice.h"
+
+static __thread int pipefd[2] = {-1, -1}; // the pipe of this thread, -1 if there's none
+
+static void close_pipe(void);
+
+/*
+ * splice_relay - move n bytes(until end of file if n < 0) from socket from to socket to.
+ *                Return the number of bytes moved, which is less than n if from reached end of file first,
+ *                or -1 on error.
+ */
+long splice_relay(int from, int to, long n)
+{
+	long total = 0;
+	ssize_t in, out, sent;
+	size_t want;
+
+	if(pipefd[0] < 0){
+		if(pipe(pipefd) < 0){
+			pipefd[0] = pipefd[1] = -1;
+			return -1;
+		}
+		fcntl(pipefd[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE); // a bigger pipe means fewer calls, the default works too
+	}
+
+	while(n < 0 || total < n){
+		want = (n < 0 || n - total > SPLICE_CHUNK) ? SPLICE_CHUNK : n - total;
+		if((in = splice(from, NULL, pipefd[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_MORE)) < 0){
+			if(errno == EINTR) continue;
+			close_pipe();
+			return -1;
+		}
+		if(in == 0)
+			break; // end of file
+
+		/* empty the pipe into to */
+		for(sent = 0; sent < in; sent += out){
+			if((out = splice(pipefd[0], NULL, to, NULL, in - sent, SPLICE_F_MOVE | SPLICE_F_MORE)) <= 0){
+				if(out < 0 && errno == EINTR){
+					out = 0;
+					continue;
+				}
+				close_pipe();
+				return -1;
+			}
+		}
+		total += in;
+	}
+	return total;
+}
+
+/*
+ * close_pipe - drop the pipe of this thread, with whatever is left in it
+ */
+static void close_pipe(void)
+{
+	close(pipefd[0]);
+	close(pipefd[1]);
+	pipefd[0] = pipefd[1] = -1;
+}
@@ -0,0 +1,12 @@
+/*
+ * splice.h - zero copy relay between two sockets, for response bodies the proxy doesn't keep.
+ */
+#ifndef __SPLICE_H__
+#define __SPLICE_H__
+
+#define SPLICE_PIPE_SIZE (1<<20) /* capacity asked for the pipe of each thread */
+#define SPLICE_CHUNK (1<<16)     /* max bytes moved by one splice call */
+
+long splice_relay(int from, int to, long n);
+
+#endif /* __SPLICE_H__ */